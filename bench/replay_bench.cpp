@@ -0,0 +1,372 @@
+// micro benchmarks for the replay hot paths against a synthetic ITCH file, or a real one
+// given by ITCH_BENCH_FILE
+#include "itch.h"
+#include "itch_file.h"
+#include "itch_generator.h"
+#include "memory_region.h"
+#include "message_buffer.h"
+#include "message_filter.h"
+#include "metrics.h"
+#include "mold_udp_64.h"
+#include "packet_ring.h"
+#include "packetizer.h"
+#include "retransmission_handler.h"
+
+#include <benchmark/benchmark.h>
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+
+namespace
+{
+constexpr std::string_view session{"BENCH00001"};
+constexpr std::size_t synthetic_msg_count{1U << 22U};
+constexpr std::size_t synthetic_locates{8000};
+
+std::filesystem::path write_synthetic_itch()
+{
+    const auto path{std::filesystem::temp_directory_path() / "itch-mold-replay-bench.itch"};
+    std::ofstream out{path, std::ios::binary | std::ios::trunc};
+    Itch_Generator generator{synthetic_locates,
+                             {{'A', 40}, {'F', 2}, {'E', 6}, {'C', 1}, {'X', 5}, {'D', 35}, {'U', 8}, {'P', 3}},
+                             1'000'000,
+                             Rate_Profile::flat,
+                             std::chrono::hours{9},
+                             1};
+    generator.write(out, synthetic_msg_count, 0);
+    return path;
+}
+
+const std::filesystem::path& itch_file_path()
+{
+    static const std::filesystem::path path{[] {
+        if (const char* env_path{std::getenv("ITCH_BENCH_FILE")})
+        {
+            return std::filesystem::path{env_path};
+        }
+        return write_synthetic_itch();
+    }()};
+    return path;
+}
+
+// mapped, or copied onto huge pages for any other backing
+Itch_File& itch_file(Page_Backing backing = Page_Backing::normal)
+{
+    static std::map<Page_Backing, std::unique_ptr<Itch_File>> files;
+    auto& file{files[backing]};
+    if (!file)
+    {
+        file = std::make_unique<Itch_File>(itch_file_path(), std::filesystem::temp_directory_path(), 0, 0, backing);
+        // a compressed ITCH_BENCH_FILE is decompressed up front so only the hot paths are timed
+        file->ensure(std::numeric_limits<std::size_t>::max());
+    }
+    return *file;
+}
+
+// start offset of every message in the file
+const std::vector<std::size_t>& msg_positions()
+{
+    static const std::vector<std::size_t> positions{[] {
+        std::vector<std::size_t> result;
+        const auto& file{itch_file()};
+        for (std::size_t pos = 0; pos + itch::len_prefix_size <= file.len();
+             pos += itch::len_prefix_size + itch::extract_len(file.at(pos)))
+        {
+            result.push_back(pos);
+        }
+        return result;
+    }()};
+    return positions;
+}
+
+const Message_Filter& filter_for(std::int64_t num_channels)
+{
+    static const Message_Filter accept_all;
+    static const auto sharded{[] {
+        constexpr std::size_t channels{4};
+        std::vector<std::size_t> channel_by_locate(itch::max_stock_locate + 1);
+        for (std::size_t locate = 0; locate < channel_by_locate.size(); ++locate)
+        {
+            channel_by_locate[locate] = locate % channels;
+        }
+        return Message_Filter::for_channels(channels, channel_by_locate);
+    }()};
+    return num_channels == 1 ? accept_all : sharded.front();
+}
+
+// every message pushed, so lookups can hit anywhere in the file. The file and checkpoints
+// are both on backing's pages
+Message_Buffer& filled_msg_buffer(Page_Backing backing = Page_Backing::normal)
+{
+    static std::map<Page_Backing, std::unique_ptr<Message_Buffer>> msg_buffers;
+    auto& buffer{msg_buffers[backing]};
+    if (!buffer)
+    {
+        buffer = std::make_unique<Message_Buffer>(itch_file(backing), filter_for(1), nullptr, backing);
+        const auto& positions{msg_positions()};
+        for (std::size_t i = 0; i < positions.size(); ++i)
+        {
+            buffer->push(i + 1, positions[i]);
+        }
+    }
+    return *buffer;
+}
+
+// cheap per thread pseudo random sequence numbers
+struct Seq_Gen
+{
+    std::uint64_t state;
+    std::uint64_t next(std::uint64_t max)
+    {
+        state = (state * 6364136223846793005ULL) + 1442695040888963407ULL;
+        return 1 + ((state >> 33U) % max);
+    }
+};
+
+void BM_Extract_Timestamp(benchmark::State& state)
+{
+    const auto& file{itch_file()};
+    const auto& positions{msg_positions()};
+    std::size_t i{0};
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(itch::extract_timestamp(file.at(positions[i])));
+        i = i + 1 == positions.size() ? 0 : i + 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Extract_Timestamp);
+
+// downstream packetization, pushing every message into the Message_Buffer as the
+// downstream does. Arg is the channel count, >1 packetizes one of 4 sharded channels
+void BM_Packetize_Downstream(benchmark::State& state)
+{
+    auto& file{itch_file()};
+    const auto& filter{filter_for(state.range(0))};
+    const Packetizer packetizer{file, filter};
+    mold_udp_64::Response_Context res_ctx{session};
+    auto msg_buffer{std::make_unique<Message_Buffer>(file, filter)};
+    std::uint64_t seq{1};
+    std::int64_t msgs{0};
+
+    for (auto _ : state)
+    {
+        if (res_ctx.file_pos >= file.len())
+        {
+            state.PauseTiming();
+            msg_buffer = std::make_unique<Message_Buffer>(file, filter);
+            res_ctx.file_pos = 0;
+            seq = 1;
+            state.ResumeTiming();
+        }
+        packetizer.fill(res_ctx, UINT16_MAX, msg_buffer.get(), seq);
+        seq += res_ctx.header.msg_count;
+        msgs += res_ctx.header.msg_count;
+        benchmark::DoNotOptimize(res_ctx);
+    }
+    state.SetItemsProcessed(msgs);
+    state.counters["packets"] = benchmark::Counter(static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_Packetize_Downstream)->Arg(1)->Arg(4);
+
+// downstream packets out over lo in batches of 32, Arg 0 is the sendmmsg() socket path and 1
+// the PACKET_TX_RING (needs CAP_NET_RAW, skipped without). Nothing joins the group, so this is
+// the sending side's cost
+void BM_Downstream_Send(benchmark::State& state)
+{
+    constexpr std::size_t batch_size{32};
+    const auto& file{itch_file()};
+    const Packetizer packetizer{file, filter_for(1)};
+    mold_udp_64::Response_Context res_ctx{session};
+
+    sockaddr_in group{};
+    group.sin_family = AF_INET;
+    group.sin_port = htons(30999);
+    inet_pton(AF_INET, "239.255.0.1", &group.sin_addr);
+
+    std::unique_ptr<Packet_Ring> ring;
+    const jam_utils::FD sock{socket(AF_INET, SOCK_DGRAM, 0)};
+    if (state.range(0) == 1)
+    {
+        try
+        {
+            ring = std::make_unique<Packet_Ring>("lo", group, group.sin_port, 1, mold_udp_64::max_payload_size);
+        }
+        catch (const std::exception& e)
+        {
+            state.SkipWithError(e.what());
+            return;
+        }
+    }
+    else
+    {
+        in_addr lo{htonl(INADDR_LOOPBACK)};
+        setsockopt(sock.fd(), IPPROTO_IP, IP_MULTICAST_IF, &lo, sizeof(lo));
+    }
+
+    std::vector<mold_udp_64::Downstream_Header> headers(batch_size);
+    std::vector<iovec> iovs(batch_size * (mold_udp_64::max_runs(mold_udp_64::max_payload_size) + 1));
+    std::vector<mmsghdr> msgs(batch_size);
+    std::int64_t packets{0};
+
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        std::size_t iov_pos{0};
+        for (std::size_t i = 0; i < batch_size; ++i)
+        {
+            if (res_ctx.file_pos >= file.len())
+            {
+                res_ctx.file_pos = 0;
+            }
+            packetizer.fill(res_ctx, UINT16_MAX);
+            headers[i] = res_ctx.header;
+            auto* iov{&iovs[iov_pos]};
+            const auto iov_len{res_ctx.fill_iov(iov, file.at(0))};
+            iov[0].iov_base = &headers[i];
+            msgs[i].msg_hdr = {&group, sizeof(group), iov, iov_len, nullptr, 0, 0};
+            iov_pos += iov_len;
+        }
+        state.ResumeTiming();
+
+        if (ring)
+        {
+            for (const auto& msg : msgs)
+            {
+                ring->queue(msg.msg_hdr.msg_iov, msg.msg_hdr.msg_iovlen);
+            }
+            ring->flush();
+        }
+        else
+        {
+            sendmmsg(sock.fd(), msgs.data(), static_cast<unsigned>(msgs.size()), 0);
+        }
+        packets += batch_size;
+    }
+    state.SetItemsProcessed(packets);
+}
+BENCHMARK(BM_Downstream_Send)->Arg(0)->Arg(1)->UseRealTime();
+
+// retransmission response packetization from random positions, Arg is the requested msg count
+void BM_Packetize_Retransmission(benchmark::State& state)
+{
+    const auto& file{itch_file()};
+    const auto& positions{msg_positions()};
+    const Packetizer packetizer{file, filter_for(1)};
+    mold_udp_64::Response_Context res_ctx{session};
+    const auto msg_count{static_cast<std::uint16_t>(state.range(0))};
+    Seq_Gen gen{42};
+
+    for (auto _ : state)
+    {
+        res_ctx.file_pos = positions[gen.next(positions.size()) - 1];
+        packetizer.fill(res_ctx, msg_count);
+        benchmark::DoNotOptimize(res_ctx);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Packetize_Retransmission)->Arg(1)->Arg(16)->Arg(64);
+
+void BM_Message_Buffer_Push(benchmark::State& state)
+{
+    auto& file{itch_file()};
+    const auto& positions{msg_positions()};
+    auto msg_buffer{std::make_unique<Message_Buffer>(file, filter_for(1))};
+    std::size_t i{0};
+
+    for (auto _ : state)
+    {
+        if (i == positions.size())
+        {
+            state.PauseTiming();
+            msg_buffer = std::make_unique<Message_Buffer>(file, filter_for(1));
+            i = 0;
+            state.ResumeTiming();
+        }
+        msg_buffer->push(i + 1, positions[i]);
+        ++i;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Message_Buffer_Push);
+
+// lookups of random sequence numbers, threads are concurrent readers as the retransmission workers are.
+// Arg is the Page_Backing, compare e.g. perf stat -e dTLB-load-misses across them
+void BM_Message_Buffer_Get_File_Pos(benchmark::State& state)
+{
+    const auto backing{static_cast<Page_Backing>(state.range(0))};
+    static std::mutex setup_mutex;
+    Message_Buffer* msg_buffer{};
+    std::string label;
+    {
+        const std::scoped_lock lock{setup_mutex};
+        msg_buffer = &filled_msg_buffer(backing);
+        // what was actually used after any fallback
+        label = std::format("file {} pages, checkpoints {} pages",
+                            to_string(itch_file(backing).backing()),
+                            to_string(msg_buffer->backing()));
+    }
+    const auto num_msgs{msg_positions().size()};
+    Seq_Gen gen{static_cast<std::uint64_t>(state.thread_index()) + 1};
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(msg_buffer->get_file_pos(gen.next(num_msgs)));
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0)
+    {
+        state.SetLabel(label);
+    }
+}
+BENCHMARK(BM_Message_Buffer_Get_File_Pos)
+    ->ArgsProduct({{static_cast<std::int64_t>(Page_Backing::normal),
+                    static_cast<std::int64_t>(Page_Backing::transparent),
+                    static_cast<std::int64_t>(Page_Backing::huge_2mb)}})
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+
+// whole request -> response path without the network, Arg is packet cache slots (0 disables)
+void BM_Build_Response(benchmark::State& state)
+{
+    auto& msg_buffer{filled_msg_buffer()};
+    const auto num_msgs{msg_positions().size()};
+    const auto cache_slots{static_cast<std::size_t>(state.range(0))};
+    auto packet_cache{cache_slots > 0 ? std::make_unique<Packet_Cache>(cache_slots) : nullptr};
+    Retransmission_Metrics metrics{session, 0};
+    Retransmission_Handler handler{session, itch_file(), msg_buffer, filter_for(1), packet_cache.get(), metrics};
+    Retransmission_Response res{session};
+    const sockaddr_in client{.sin_family = AF_INET, .sin_port = htons(40000), .sin_addr = {htonl(INADDR_LOOPBACK)}, .sin_zero = {}};
+    const auto now{std::chrono::steady_clock::now()};
+
+    mold_udp_64::Retransmission_Request request{session};
+    request.msg_count = htons(16);
+    // gap requests cluster, both runs draw from the same window so only the cache differs
+    constexpr std::uint64_t request_window{2048};
+    Seq_Gen gen{7};
+    const auto window{std::min<std::uint64_t>(num_msgs, request_window)};
+
+    for (auto _ : state)
+    {
+        request.sequence_num = htobe64(gen.next(window));
+        benchmark::DoNotOptimize(handler.build_response(&request, sizeof(request), client, now, res));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["cache_hit_rate"] = static_cast<double>(metrics.cache_hits.load()) /
+                                       static_cast<double>(std::max<std::uint64_t>(metrics.requests.load(), 1));
+}
+BENCHMARK(BM_Build_Response)->Arg(0)->Arg(4096);
+} // namespace
+
+BENCHMARK_MAIN();
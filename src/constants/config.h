@@ -1,13 +1,45 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <chrono>
 #include <cstddef>
 #include <netinet/in.h>
 
 namespace config
 {
-constexpr std::size_t msg_buffer_size{1U << 22U};
+constexpr std::size_t msg_checkpoint_interval{32}; // Message_Buffer lookups walk at most this many messages
+constexpr std::size_t msg_checkpoint_chunk{std::size_t{1} << 28U}; // bytes a streamed file's Message_Buffer grows by
 constexpr int epoll_max_events{1024};
+constexpr std::size_t retrans_batch_size{64}; // requests per recvmmsg()/responses per sendmmsg()
+constexpr std::size_t packet_cache_slots{1U << 12U}; // ~5 MB of built retransmission responses
+constexpr std::size_t throttle_max_clients{1U << 16U}; // per worker and session channel, idle clients are evicted past this
+constexpr std::chrono::seconds throttle_client_idle{10};
+constexpr std::chrono::milliseconds max_coalesce_window{5}; // well under MoldUDP64 clients' retransmission retry intervals
+constexpr std::size_t max_send_batch{1024}; // UIO_MAXIOV, the sendmmsg() vlen limit
+constexpr std::size_t zerocopy_header_ring_size{max_send_batch * 4};
+constexpr std::size_t tx_ring_frames{max_send_batch}; // PACKET_TX_RING frames, a full send batch fits without waiting
+constexpr std::size_t index_checkpoint_interval{1U << 12U};
+// lazy loading
+constexpr std::chrono::milliseconds prefetch_interval{10};
+constexpr std::size_t prefetch_step{std::size_t{1} << 20U}; // readers publish their position at this granularity
+constexpr std::size_t max_file_readers{64}; // downstream channels reading one file, as many as --channels allows
+// compressed input
+constexpr std::size_t stream_reserve_len{std::size_t{1} << 38U}; // address space for the decompressed file
+constexpr std::size_t stream_map_chunk{std::size_t{1} << 28U}; // spill file grows by this much
+constexpr std::size_t stream_read_size{std::size_t{1} << 20U}; // decompressed bytes published at a time
+// pacing
+constexpr std::chrono::milliseconds tsc_calibration_time{20};
+constexpr std::chrono::microseconds spin_threshold{100}; // hybrid pacing spins for the last this much of a wait
+// SoupBinTCP fan out
+constexpr std::size_t soup_bin_writev_iovs{1024}; // IOV_MAX, a header and a payload iovec per message
+constexpr std::size_t soup_bin_client_buffer{64}; // a login request with slack, clients send nothing larger
+constexpr std::chrono::milliseconds soup_bin_poll_interval{100}; // heartbeats and timeouts are checked this often
+// io_uring retransmission engine
+constexpr unsigned uring_entries{1024};
+constexpr unsigned uring_recv_buffers{1024}; // provided buffer ring, power of 2
+constexpr std::size_t uring_recv_buffer_size{64}; // io_uring_recvmsg_out + sockaddr_in + request with slack
+constexpr std::size_t uring_send_slots{512};
+constexpr unsigned uring_cqe_batch{256};
 } // namespace config
 
 #endif
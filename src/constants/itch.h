@@ -1,6 +1,7 @@
 #ifndef ITCH_H
 #define ITCH_H
 
+#include <array>
 #include <cstdint>
 #include <cstddef>
 #include <cstring>
@@ -10,6 +11,7 @@
 namespace itch
 {
 constexpr std::size_t len_prefix_size{sizeof(std::uint16_t)};
+constexpr std::size_t stock_locate_offset{len_prefix_size + 1};
 constexpr std::size_t timestamp_offset{len_prefix_size +
                                        1 + // message type
                                        2 + // stock locate
@@ -26,6 +28,68 @@ inline std::uint64_t extract_timestamp(const std::byte* msg_start)
 }
 
 constexpr std::size_t max_msg_len{50};
+constexpr std::size_t min_msg_total_len{len_prefix_size + 12}; // system event / mwcb status
+
+inline std::uint16_t extract_len(const std::byte* msg_start)
+{
+    std::uint16_t len_prefix;
+    std::memcpy(&len_prefix, msg_start, len_prefix_size);
+    return be16toh(len_prefix);
+}
+
+constexpr std::size_t msg_type_offset{len_prefix_size};
+
+inline char extract_msg_type(const std::byte* msg_start)
+{
+    return static_cast<char>(msg_start[msg_type_offset]);
+}
+
+// 0 for messages which are not about a single stock (e.g. system events)
+inline std::uint16_t extract_stock_locate(const std::byte* msg_start)
+{
+    std::uint16_t locate;
+    std::memcpy(&locate, msg_start + stock_locate_offset, sizeof(locate));
+    return be16toh(locate);
+}
+
+constexpr std::size_t max_stock_locate{UINT16_MAX};
+
+// stock directory ('R') symbol, right padded with spaces
+constexpr std::size_t stock_offset{timestamp_offset + timestamp_size};
+constexpr std::size_t stock_len{8};
+
+// system event ('S') event code
+constexpr std::size_t event_code_offset{timestamp_offset + timestamp_size};
+constexpr char start_of_market_hours{'Q'};
+
+// message length (excluding the length prefix) by message type, 0 for unknown types
+constexpr std::array<std::uint8_t, 256> msg_len_by_type{[] {
+    std::array<std::uint8_t, 256> lens{};
+    lens['S'] = 12; // system event
+    lens['R'] = 39; // stock directory
+    lens['H'] = 25; // stock trading action
+    lens['Y'] = 20; // reg sho restriction
+    lens['L'] = 26; // market participant position
+    lens['V'] = 35; // mwcb decline level
+    lens['W'] = 12; // mwcb status
+    lens['K'] = 28; // ipo quoting period update
+    lens['J'] = 35; // luld auction collar
+    lens['h'] = 21; // operational halt
+    lens['A'] = 36; // add order
+    lens['F'] = 40; // add order mpid
+    lens['E'] = 31; // order executed
+    lens['C'] = 36; // order executed with price
+    lens['X'] = 23; // order cancel
+    lens['D'] = 19; // order delete
+    lens['U'] = 35; // order replace
+    lens['P'] = 44; // trade
+    lens['Q'] = 40; // cross trade
+    lens['B'] = 19; // broken trade
+    lens['I'] = 50; // noii
+    lens['N'] = 20; // rpii
+    lens['O'] = 48; // direct listing with capital raise price discovery
+    return lens;
+}()};
 } // namespace itch
 
 #endif
@@ -8,6 +8,10 @@
 #include <array>
 #include <cassert>
 #include <chrono>
+#include <sys/uio.h>
+#include <vector>
+
+#include "itch.h"
 
 // https://www.nasdaqtrader.com/content/technicalsupport/specifications/dataproducts/moldudp64.pdf
 
@@ -15,6 +19,7 @@ namespace mold_udp_64
 {
 
 constexpr std::size_t mtu_size{1200}; // this is left with a little headroom for example VPN
+constexpr std::size_t max_jumbo_mtu_size{9000};
 constexpr std::size_t udp_header_size{28};
 constexpr std::size_t max_payload_size{mtu_size - udp_header_size};
 
@@ -39,19 +44,74 @@ struct __attribute__((__packed__)) Downstream_Header
     }
 };
 
+// the messages of a packet are sent straight from the mapping with scatter/gather io rather
+// than copied into a buffer. Consecutive messages are contiguous in the file so a packet is
+// usually one run, a filtered channel starts a new run after each skipped message
+struct Payload_Run
+{
+    std::size_t pos;
+    std::size_t len;
+};
+
+constexpr std::size_t max_runs(std::size_t payload_size)
+{
+    return ((payload_size - sizeof(Downstream_Header)) / itch::min_msg_total_len) + 1;
+}
+
+constexpr std::size_t max_payload_runs{max_runs(max_payload_size)};
+
 struct Response_Context
 {
     Downstream_Header header;
-    std::array<std::byte, max_payload_size> buff{};
-    std::size_t buff_len{};
+    std::vector<Payload_Run> runs;
+    std::size_t num_runs{};
+    std::size_t payload_len{};
     std::size_t file_pos{};
+    std::size_t last_msg_pos{};
+
+    // payload_size is the UDP payload limit, the runs are sized for a packet of the smallest messages
+    explicit Response_Context(std::string_view session, std::size_t payload_size = max_payload_size)
+        : header{session},
+          runs(max_runs(payload_size))
+    {
+    }
+
+    std::size_t packet_len() const { return sizeof(Downstream_Header) + payload_len; }
+
+    void clear_payload()
+    {
+        num_runs = 0;
+        payload_len = 0;
+    }
+
+    void append(std::size_t pos, std::size_t len)
+    {
+        last_msg_pos = pos;
+        if (num_runs > 0 && runs[num_runs - 1].pos + runs[num_runs - 1].len == pos)
+        {
+            runs[num_runs - 1].len += len;
+        }
+        else
+        {
+            runs[num_runs++] = {pos, len};
+        }
+        payload_len += len;
+    }
 
-    explicit Response_Context(std::string_view session)
-        : header{session}
+    // header then payload runs of the file mapped at file_base, returns the iovecs used
+    std::size_t fill_iov(iovec* iov, std::byte* file_base)
     {
+        iov[0] = {&header, sizeof(Downstream_Header)};
+        for (std::size_t i = 0; i < num_runs; ++i)
+        {
+            iov[i + 1] = {file_base + runs[i].pos, runs[i].len};
+        }
+        return num_runs + 1;
     }
 };
 
+constexpr std::size_t max_packet_iovs{max_payload_runs + 1};
+
 using Retransmission_Request = Downstream_Header; // these are actually the same
 
 constexpr std::uint16_t end_of_session_flag{0xFFFF};
@@ -1,9 +1,12 @@
 #ifndef NASDAQ_H
 #define NASDAQ_H
 
+#include <charconv>
 #include <chrono>
 #include <map>
+#include <optional>
 #include <string>
+#include <string_view>
 
 namespace nasdaq
 {
@@ -34,6 +37,69 @@ constexpr std::chrono::nanoseconds market_phase_to_timestamp(const Market_Phase
 const std::map<std::string, Market_Phase> market_phase_map{{"pre", Market_Phase::pre},
                                                            {"open", Market_Phase::open},
                                                            {"close", Market_Phase::close}};
+// HH:MM:SS[.fraction] since midnight, the same clock as ITCH timestamps
+inline std::optional<std::chrono::nanoseconds> parse_time_of_day(std::string_view str)
+{
+    const auto parse_field{[&str](std::size_t digits, std::int64_t max) -> std::optional<std::int64_t> {
+        std::int64_t val{};
+        if (str.size() < digits ||
+            std::from_chars(str.data(), str.data() + digits, val).ptr != str.data() + digits ||
+            val > max)
+        {
+            return std::nullopt;
+        }
+        str.remove_prefix(digits);
+        return val;
+    }};
+    const auto parse_sep{[&str](char sep) {
+        if (str.empty() || str.front() != sep)
+        {
+            return false;
+        }
+        str.remove_prefix(1);
+        return true;
+    }};
+
+    const auto hours{parse_field(2, 23)};
+    if (!hours || !parse_sep(':'))
+    {
+        return std::nullopt;
+    }
+    const auto minutes{parse_field(2, 59)};
+    if (!minutes || !parse_sep(':'))
+    {
+        return std::nullopt;
+    }
+    const auto seconds{parse_field(2, 59)};
+    if (!seconds)
+    {
+        return std::nullopt;
+    }
+
+    std::chrono::nanoseconds time_of_day{std::chrono::hours{*hours} +
+                                         std::chrono::minutes{*minutes} +
+                                         std::chrono::seconds{*seconds}};
+    if (str.empty())
+    {
+        return time_of_day;
+    }
+    if (!parse_sep('.') || str.empty() || str.size() > 9)
+    {
+        return std::nullopt;
+    }
+    const auto digits{str.size()};
+    const auto fraction{parse_field(digits, 999'999'999)};
+    if (!fraction)
+    {
+        return std::nullopt;
+    }
+    std::int64_t scale{1};
+    for (std::size_t i = digits; i < 9; ++i)
+    {
+        scale *= 10;
+    }
+    return time_of_day + std::chrono::nanoseconds{*fraction * scale};
+}
 } // namespace nasdaq
 
 #endif
@@ -0,0 +1,45 @@
+#ifndef SOUP_BIN_TCP_H
+#define SOUP_BIN_TCP_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// https://www.nasdaqtrader.com/content/technicalsupport/specifications/dataproducts/soupbintcp.pdf
+
+namespace soup_bin_tcp
+{
+// every packet is a big endian length of the type byte and payload, then the type byte
+constexpr std::size_t len_prefix_size{sizeof(std::uint16_t)};
+constexpr std::size_t header_size{len_prefix_size + 1};
+
+constexpr std::size_t username_len{6};
+constexpr std::size_t password_len{10};
+constexpr std::size_t session_len{10};
+constexpr std::size_t sequence_num_len{20}; // ascii, left padded with spaces
+
+// server packets
+constexpr char debug{'+'};
+constexpr char login_accepted{'A'};
+constexpr char login_rejected{'J'};
+constexpr char sequenced_data{'S'};
+constexpr char server_heartbeat{'H'};
+constexpr char end_of_session{'Z'};
+
+// client packets
+constexpr char login_request{'L'};
+constexpr char unsequenced_data{'U'};
+constexpr char client_heartbeat{'R'};
+constexpr char logout_request{'O'};
+
+constexpr std::size_t login_request_len{username_len + password_len + session_len + sequence_num_len};
+
+// login rejected reasons
+constexpr char not_authorized{'A'};
+constexpr char session_not_available{'S'};
+
+constexpr std::chrono::seconds heartbeat_interval{1};
+constexpr std::chrono::seconds client_timeout{15};
+} // namespace soup_bin_tcp
+
+#endif
@@ -1,17 +1,120 @@
+#include "config.h"
 #include "message_buffer.h"
+#include "message_filter.h"
+#include "metrics.h"
+#include "memory_region.h"
+#include "metrics_exporter.h"
 #include "mold_udp_64.h"
 #include "nasdaq.h"
+#include "pacer.h"
+#include "rate_limiter.h"
 #include "retransmission_server.h"
 #include "downstream_server.h"
+#include "itch.h"
+#include "itch_file.h"
+#include "packet_file.h"
+#include "session_index.h"
+#include "soup_bin_server.h"
+#include "stock_directory.h"
+#include "thread_placement.h"
 
 #include <CLI/App.hpp>
-#include "jamutils/M_Map.h"
+#include <arpa/inet.h>
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <exception>
 #include <filesystem>
 #include <memory>
+#include <optional>
+#include <ranges>
 #include <print>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <format>
+#include <thread>
+#include <vector>
+
+namespace
+{
+// one session replayed from one file, channel i on group + i and port + i
+struct Replay
+{
+    std::string session;
+    std::filesystem::path itch_file_path;
+    std::string downstream_group;
+    int downstream_port;
+    std::unique_ptr<Itch_File> itch_file;
+    std::optional<Session_Index> session_index;
+    std::optional<Packet_File> packet_file;
+    std::vector<Message_Filter> filters;
+};
+
+std::string offset_group(const std::string& group, std::size_t offset)
+{
+    in_addr addr{};
+    if (inet_pton(AF_INET, group.c_str(), &addr) != 1)
+    {
+        throw std::invalid_argument(std::format("invalid ip format for downstream group {}", group));
+    }
+    const auto is_multicast{[](std::uint64_t host_addr) { return (host_addr & 0xf0000000U) == 0xe0000000U; }};
+    const std::uint64_t base{ntohl(addr.s_addr)};
+    const auto offset_addr{base + offset};
+    if (offset_addr > UINT32_MAX || (is_multicast(base) && !is_multicast(offset_addr)))
+    {
+        throw std::invalid_argument(std::format("downstream group {} + {} leaves the multicast range", group, offset));
+    }
+    addr.s_addr = htonl(static_cast<std::uint32_t>(offset_addr));
+    std::array<char, INET_ADDRSTRLEN> group_str{};
+    inet_ntop(AF_INET, &addr, group_str.data(), group_str.size());
+    return group_str.data();
+}
+
+// each channel takes the next port after base
+void check_port_range(std::string_view name, int base, std::size_t num_channels)
+{
+    if (base < 1025 || base + static_cast<int>(num_channels) - 1 > 65535)
+    {
+        throw std::invalid_argument(std::format("{} {} leaves no port in [1025 - 65535] for {} channels", name, base, num_channels));
+    }
+}
+
+// SESSION,FILE[,GROUP,PORT]
+Replay parse_replay(std::string_view spec, std::string default_group, int default_port)
+{
+    std::vector<std::string> fields;
+    for (const auto field : std::views::split(spec, ','))
+    {
+        fields.emplace_back(std::string_view{field});
+    }
+    if ((fields.size() != 2 && fields.size() != 4) || fields[0].length() != mold_udp_64::session_len)
+    {
+        throw std::invalid_argument(std::format("--replay {} expected SESSION,FILE[,GROUP,PORT] with a {} character session",
+                                                spec,
+                                                mold_udp_64::session_len));
+    }
+    if (!std::filesystem::is_regular_file(fields[1]))
+    {
+        throw std::invalid_argument(std::format("--replay {} file {} does not exist", spec, fields[1]));
+    }
+
+    Replay replay{fields[0], fields[1], std::move(default_group), default_port, nullptr, std::nullopt, std::nullopt, {}};
+    if (fields.size() == 4)
+    {
+        replay.downstream_group = fields[2];
+        if (std::from_chars(fields[3].data(), fields[3].data() + fields[3].size(), replay.downstream_port).ec != std::errc{} ||
+            replay.downstream_port < 1025 || replay.downstream_port > 65535)
+        {
+            throw std::invalid_argument(std::format("--replay {} port must be in [1025 - 65535]", spec));
+        }
+    }
+    return replay;
+}
+} // namespace
 
 int main(const int argc, char** argv)
 {
@@ -33,10 +136,39 @@ int main(const int argc, char** argv)
     std::filesystem::path itch_file_path;
     cli.add_option("itch_file_path",
                    itch_file_path,
-                   "NASDAQ ITCH 5.0 binary message file")
+                   "NASDAQ ITCH 5.0 binary message file, .gz or .zst files are decompressed while replaying")
         ->required()
         ->check(CLI::ExistingFile);
 
+    std::filesystem::path spill_dir{std::filesystem::temp_directory_path()};
+    cli.add_option("--spill-dir",
+                   spill_dir,
+                   "Directory for the unlinked file a compressed itch file is decompressed into")
+        ->check(CLI::ExistingDirectory)
+        ->capture_default_str();
+
+    std::size_t prefetch_window_mb{0};
+    std::size_t prefetch_retain_mb{0};
+
+    cli.add_option("--prefetch-window",
+                   prefetch_window_mb,
+                   "MiB of the itch file read ahead of the downstream, 0 loads the whole file before starting")
+        ->capture_default_str();
+
+    cli.add_option("--prefetch-retain",
+                   prefetch_retain_mb,
+                   "MiB kept in memory behind the downstream with --prefetch-window, 0 keeps everything")
+        ->capture_default_str();
+
+    auto page_backing{Page_Backing::normal};
+    cli.add_option("--huge-pages",
+                   page_backing,
+                   "Back the message buffers, and the itch file unless prefetching or compressed, with huge pages (off, thp, 2m, 1g)")
+        ->transform(
+            CLI::CheckedTransformer(page_backing_map,
+                                    CLI::ignore_case))
+        ->capture_default_str();
+
     std::string downstream_group{"239.0.0.1"};
     int downstream_port{30000};
     int downstream_ttl{1};
@@ -59,9 +191,9 @@ int main(const int argc, char** argv)
         ->check(CLI::Range(0, 255))
         ->capture_default_str();
 
-    cli.add_flag("--loopback",
-                 loopback,
-                 "Enable downstream multicast loopback");
+    auto* loopback_opt{cli.add_flag("--loopback",
+                                    loopback,
+                                    "Enable downstream multicast loopback")};
 
     std::string retrans_address{"127.0.0.1"};
     int retrans_port{31000};
@@ -77,52 +209,633 @@ int main(const int argc, char** argv)
         ->check(CLI::Range(1025, 65535))
         ->capture_default_str();
 
+    std::string soup_bin_address{"127.0.0.1"};
+    int soup_bin_port{0};
+
+    cli.add_option("--soup-address",
+                   soup_bin_address,
+                   "SoupBinTCP server address")
+        ->capture_default_str();
+
+    cli.add_option("--soup-port",
+                   soup_bin_port,
+                   "Also serve the downstream over SoupBinTCP, session and channel i (in --replay order) on port + i. "
+                   "0 disables")
+        ->check(CLI::Range(0, 65535))
+        ->capture_default_str();
+
+    auto retrans_engine{Retransmission_Engine::epoll};
+    cli.add_option("--retrans-engine",
+                   retrans_engine,
+                   "Retransmission worker engine (epoll, io_uring)")
+        ->transform(
+            CLI::CheckedTransformer(retransmission_engine_map,
+                                    CLI::ignore_case))
+        ->capture_default_str();
+
+    std::size_t packet_cache_slots{config::packet_cache_slots};
+    cli.add_option("--retrans-cache-slots",
+                   packet_cache_slots,
+                   "Retransmission response cache slots, power of 2 or 0 to disable")
+        ->check([](const std::string& str) {
+            std::size_t slots{};
+            if (std::from_chars(str.data(), str.data() + str.size(), slots).ec != std::errc{} ||
+                (slots != 0 && !std::has_single_bit(slots)))
+            {
+                return "cache slots must be a power of 2 or 0";
+            }
+            return "";
+        })
+        ->capture_default_str();
+
+    double retrans_client_rate{0};
+    double retrans_client_burst{64};
+    std::int64_t retrans_coalesce_us{0};
+
+    cli.add_option("--retrans-client-rate",
+                   retrans_client_rate,
+                   "Retransmission responses per second each client address may get, 0 for no limit")
+        ->check(CLI::NonNegativeNumber)
+        ->capture_default_str();
+
+    cli.add_option("--retrans-client-burst",
+                   retrans_client_burst,
+                   "Responses a client may get back to back under --retrans-client-rate")
+        ->check(CLI::NonNegativeNumber)
+        ->capture_default_str();
+
+    cli.add_option("--retrans-coalesce-window",
+                   retrans_coalesce_us,
+                   "Microseconds a repeat of a client's last answered request is dropped as a duplicate, 0 answers every "
+                   "request")
+        ->check(CLI::Range(std::int64_t{0}, std::int64_t{std::chrono::microseconds{config::max_coalesce_window}.count()}))
+        ->capture_default_str();
+
     double replay_speed{1.0};
     auto start_phase{nasdaq::Market_Phase::pre};
 
-    cli.add_option("--replay-speed,--speed",
-                   replay_speed,
-                   "Downstream replay speed")
+    auto* replay_speed_opt{cli.add_option("--replay-speed,--speed",
+                                          replay_speed,
+                                          "Downstream replay speed")
+                               ->check(CLI::PositiveNumber)
+                               ->capture_default_str()};
+
+    double rate{0};
+    auto rate_unit{Rate_Unit::msgs};
+    double burst{0};
+    double ramp_step{0};
+    std::int64_t ramp_interval_s{30};
+    double max_rate{0};
+
+    cli.add_option("--rate",
+                   rate,
+                   "Pace each channel to this many --rate-unit per second ignoring the ITCH timestamps, 0 replays by timestamp")
+        ->check(CLI::NonNegativeNumber)
+        ->excludes(replay_speed_opt)
+        ->capture_default_str();
+
+    cli.add_option("--rate-unit",
+                   rate_unit,
+                   "Unit of --rate, --burst, --ramp-step and --max-rate (msgs, packets, mbps)")
+        ->transform(
+            CLI::CheckedTransformer(rate_unit_map,
+                                    CLI::ignore_case))
+        ->capture_default_str();
+
+    cli.add_option("--burst",
+                   burst,
+                   "Token bucket size in --rate-unit, how far ahead of the rate a sender may get after falling behind")
+        ->check(CLI::NonNegativeNumber)
+        ->capture_default_str();
+
+    cli.add_option("--ramp-step",
+                   ramp_step,
+                   "Raise --rate by this much every --ramp-interval")
+        ->check(CLI::NonNegativeNumber)
+        ->capture_default_str();
+
+    cli.add_option("--ramp-interval",
+                   ramp_interval_s,
+                   "Seconds between --ramp-step increases, the achieved rate is reported for each")
         ->check(CLI::PositiveNumber)
         ->capture_default_str();
 
-    cli.add_option("--start-phase,--phase,--start",
-                   start_phase,
-                   "Market phase to start replay (pre, open, close)")
+    cli.add_option("--max-rate",
+                   max_rate,
+                   "Stop ramping at this rate, 0 for no limit")
+        ->check(CLI::NonNegativeNumber)
+        ->capture_default_str();
+
+    auto* start_phase_opt{cli.add_option("--start-phase,--phase,--start",
+                                         start_phase,
+                                         "Market phase to start replay (pre, open, close)")
+                              ->transform(
+                                  CLI::CheckedTransformer(nasdaq::market_phase_map,
+                                                          CLI::ignore_case))
+                              ->capture_default_str()};
+
+    std::string start_time;
+    cli.add_option("--start-time",
+                   start_time,
+                   "Time of day to start replay (HH:MM:SS[.fraction])")
+        ->check([](const std::string& str) {
+            if (!nasdaq::parse_time_of_day(str))
+            {
+                return "start time must be HH:MM:SS[.fraction]";
+            }
+            return "";
+        })
+        ->excludes(start_phase_opt);
+
+    auto pacing_mode{Pacing_Mode::sleep};
+    std::int64_t spin_threshold_us{config::spin_threshold.count()};
+
+    cli.add_option("--pacing",
+                   pacing_mode,
+                   "Downstream pacing (sleep, hybrid, spin)")
         ->transform(
-            CLI::CheckedTransformer(nasdaq::market_phase_map,
+            CLI::CheckedTransformer(pacing_mode_map,
                                     CLI::ignore_case))
         ->capture_default_str();
 
+    cli.add_option("--spin-threshold",
+                   spin_threshold_us,
+                   "Microseconds before a send time hybrid pacing stops sleeping and spins")
+        ->check(CLI::NonNegativeNumber)
+        ->capture_default_str();
+
+    bool use_index{false};
+    auto* index_opt{cli.add_flag("--index",
+                                 use_index,
+                                 "Seek to the start using the <itch_file>.idx sidecar, building it first if missing or stale")};
+
+    bool use_packet_file{false};
+    auto* packet_file_opt{cli.add_flag("--packets",
+                                       use_packet_file,
+                                       "Send the packets compiled into the <itch_file>.pkt sidecar instead of packetizing at "
+                                       "runtime, compiling it first if missing or stale for this --mtu and --max-packet-delay")
+                              ->excludes(index_opt)};
+
+    std::size_t send_batch_size{1};
+    std::int64_t max_batch_hold_us{50};
+
+    cli.add_option("--send-batch",
+                   send_batch_size,
+                   "Max due downstream packets sent per sendmmsg()")
+        ->check(CLI::Range(std::size_t{1}, config::max_send_batch))
+        ->capture_default_str();
+
+    cli.add_option("--max-batch-hold",
+                   max_batch_hold_us,
+                   "Max time in microseconds a due packet is held waiting for the batch to fill")
+        ->check(CLI::NonNegativeNumber)
+        ->capture_default_str();
+
+    bool zerocopy{false};
+    auto* zerocopy_opt{cli.add_flag("--zerocopy",
+                                    zerocopy,
+                                    "Send downstream payloads with MSG_ZEROCOPY")};
+
+    std::string tx_ring_interface;
+    cli.add_option("--tx-ring",
+                   tx_ring_interface,
+                   "Interface, e.g. eth0 or lo, to send downstream packets on as whole Ethernet frames through a "
+                   "PACKET_TX_RING instead of the UDP socket. Needs CAP_NET_RAW")
+        ->excludes(zerocopy_opt)
+        ->excludes(loopback_opt);
+
+    std::size_t pipeline_depth{0};
+    cli.add_option("--pipeline-depth",
+                   pipeline_depth,
+                   "Packets a separate builder thread per channel may parse and packetize ahead of the sender, which "
+                   "then only paces and sends. 0 does both on the sender thread")
+        ->check(CLI::Range(std::size_t{0}, std::size_t{1} << 20U))
+        ->excludes(packet_file_opt)
+        ->capture_default_str();
+
+    std::size_t mtu{mold_udp_64::mtu_size};
+    std::int64_t max_packet_delay_us{0};
+
+    cli.add_option("--mtu",
+                   mtu,
+                   "Largest downstream packet including IP and UDP headers, up to 9000 for jumbo frames. Retransmission "
+                   "responses stay at the default")
+        ->check(CLI::Range(mold_udp_64::udp_header_size + sizeof(mold_udp_64::Downstream_Header) + itch::len_prefix_size + itch::max_msg_len,
+                           mold_udp_64::max_jumbo_mtu_size))
+        ->capture_default_str();
+
+    cli.add_option("--max-packet-delay",
+                   max_packet_delay_us,
+                   "Close a downstream packet before a message timestamped more than this many microseconds after its "
+                   "first, and send it at its last message's timestamp. 0 fills packets regardless and sends them at "
+                   "their first message's")
+        ->check(CLI::NonNegativeNumber)
+        ->capture_default_str();
+
+    std::size_t num_channels{1};
+    std::filesystem::path channel_map_path;
+
+    cli.add_option("--channels",
+                   num_channels,
+                   "Downstream channels, stocks are sharded across them by locate. Channel i uses group + i, "
+                   "downstream port + i and retransmission port + i")
+        ->check(CLI::Range(std::size_t{1}, std::size_t{64}))
+        ->capture_default_str();
+
+    cli.add_option("--channel-map",
+                   channel_map_path,
+                   "SYMBOL,channel lines pinning stocks to channels, the rest are spread round robin")
+        ->check(CLI::ExistingFile);
+
+    std::vector<std::string> symbols;
+    std::string msg_types;
+
+    cli.add_option("--symbols",
+                   symbols,
+                   "Only replay these stocks' messages, e.g. AAPL,MSFT, plus system wide ones. Sequence numbers stay dense")
+        ->delimiter(',');
+
+    cli.add_option("--msg-types",
+                   msg_types,
+                   "Only replay these ITCH message types, e.g. SRAFEXDUP")
+        ->check([](const std::string& str) {
+            for (const auto type : str)
+            {
+                if (itch::msg_len_by_type[static_cast<std::uint8_t>(type)] == 0)
+                {
+                    return "unknown ITCH message type";
+                }
+            }
+            return "";
+        });
+
+    std::vector<std::string> extra_replay_specs;
+    std::size_t retrans_threads{0};
+
+    cli.add_option("--replay",
+                   extra_replay_specs,
+                   "Another session to replay alongside, SESSION,FILE[,GROUP,PORT]. The group and port default to those "
+                   "after the previous session's channels, retransmission ports are shared and requests routed by session");
+
+    cli.add_option("--retrans-threads",
+                   retrans_threads,
+                   "Retransmission workers shared by every session and channel, 0 for the cores left after the downstream senders")
+        ->capture_default_str();
+
+    std::string downstream_cpus;
+    std::string retrans_cpus;
+    int numa_node{-1};
+    int fifo_priority{0};
+
+    cli.add_option("--downstream-cpus",
+                   downstream_cpus,
+                   "CPU list, e.g. 2,3, one for each downstream sender in session then channel order. Every other "
+                   "thread is kept off them");
+
+    cli.add_option("--retrans-cpus",
+                   retrans_cpus,
+                   "CPU list, e.g. 4-7, the retransmission workers are pinned to one each in turn. --retrans-threads "
+                   "defaults to one per CPU");
+
+    cli.add_option("--numa-node",
+                   numa_node,
+                   "NUMA node the itch files, message buffers and everything else are allocated on, -1 leaves it to the kernel")
+        ->check(CLI::Range(-1, 1023))
+        ->capture_default_str();
+
+    cli.add_option("--fifo-priority",
+                   fifo_priority,
+                   "SCHED_FIFO priority for the downstream senders, 0 keeps the normal scheduler")
+        ->check(CLI::Range(0, 99))
+        ->capture_default_str();
+
+    std::filesystem::path metrics_socket_path;
+    std::filesystem::path metrics_file_path;
+    std::int64_t metrics_interval_ms{1000};
+
+    cli.add_option("--metrics-socket",
+                   metrics_socket_path,
+                   "UNIX socket serving a metrics snapshot to each connection");
+
+    cli.add_option("--metrics-file",
+                   metrics_file_path,
+                   "File rewritten with a metrics snapshot every --metrics-interval");
+
+    cli.add_option("--metrics-interval",
+                   metrics_interval_ms,
+                   "Milliseconds between --metrics-file snapshots")
+        ->check(CLI::PositiveNumber)
+        ->capture_default_str();
+
     CLI11_PARSE(cli, argc, argv);
 
     try
     {
-        jam_utils::M_Map itch_file{itch_file_path,
-                                   PROT_READ,
-                                   MAP_PRIVATE | MAP_POPULATE,
-                                   0};
-        std::println("File loaded");
-        auto msg_buffer{std::make_unique<Message_Buffer>()};
-        Retransmission_Server retrans_server{session,
-                                             retrans_address,
-                                             static_cast<std::uint16_t>(retrans_port),
-                                             itch_file,
-                                             *msg_buffer};
-        std::println("Retransmission server started");
-        Downstream_Server downstream_server{session,
-                                            downstream_group,
-                                            static_cast<std::uint16_t>(downstream_port),
-                                            static_cast<std::uint8_t>(downstream_ttl),
-                                            loopback,
-                                            replay_speed,
-                                            start_phase,
-                                            itch_file,
-                                            *msg_buffer};
-        std::println("Downstream server started");
-        downstream_server.start();
+        Metrics metrics;
+
+        check_port_range("--downstream-port", downstream_port, num_channels);
+        check_port_range("--retrans-port", retrans_port, num_channels);
+
+        std::vector<Replay> replays;
+        replays.push_back({session, itch_file_path, downstream_group, downstream_port, nullptr, std::nullopt, std::nullopt, {}});
+        for (const auto& spec : extra_replay_specs)
+        {
+            const auto& previous{replays.back()};
+            replays.push_back(parse_replay(spec,
+                                           offset_group(previous.downstream_group, num_channels),
+                                           previous.downstream_port + static_cast<int>(num_channels)));
+            // the port defaults to following the previous replay's channels
+            check_port_range(std::format("--replay {} downstream port", spec), replays.back().downstream_port, num_channels);
+        }
+
+        // before anything is loaded or any thread started so memory and threads inherit it
+        const Thread_Placement placement{downstream_cpus.empty() ? std::vector<int>{} : parse_cpu_list(downstream_cpus),
+                                         retrans_cpus.empty() ? std::vector<int>{} : parse_cpu_list(retrans_cpus),
+                                         numa_node,
+                                         fifo_priority,
+                                         replays.size() * num_channels};
+        placement.apply();
+        std::print("{}", placement.report());
+
+        const auto start_replay_at{start_time.empty() ? nasdaq::market_phase_to_timestamp(start_phase)
+                                                      : *nasdaq::parse_time_of_day(start_time)};
+
+        std::optional<Rate_Limiter> rate_limiter;
+        if (rate > 0)
+        {
+            rate_limiter.emplace(rate_unit, rate, burst, ramp_step, std::chrono::seconds{ramp_interval_s}, max_rate);
+        }
+
+        if (use_packet_file && (num_channels > 1 || !symbols.empty() || !msg_types.empty()))
+        {
+            throw std::invalid_argument("--packets sends every message of the file, it can't be combined with "
+                                        "--channels, --symbols or --msg-types");
+        }
+
+        for (auto& replay : replays)
+        {
+            if (use_index && Itch_File::is_compressed(replay.itch_file_path))
+            {
+                throw std::invalid_argument(std::format("--index needs an uncompressed itch file, {} is compressed",
+                                                        replay.itch_file_path.string()));
+            }
+            if (use_packet_file && Itch_File::is_compressed(replay.itch_file_path))
+            {
+                throw std::invalid_argument(std::format("--packets needs an uncompressed itch file, {} is compressed",
+                                                        replay.itch_file_path.string()));
+            }
+
+            replay.itch_file = std::make_unique<Itch_File>(replay.itch_file_path,
+                                                           spill_dir,
+                                                           prefetch_window_mb << 20U,
+                                                           prefetch_retain_mb << 20U,
+                                                           page_backing);
+            const auto& itch_file{*replay.itch_file};
+            if (itch_file.streaming())
+            {
+                std::println("{} file streaming", replay.session);
+            }
+            else
+            {
+                std::println("{} file {}", replay.session, prefetch_window_mb > 0 ? "mapped, prefetching" : "loaded");
+            }
+            if (page_backing != Page_Backing::normal && !itch_file.streaming() && prefetch_window_mb == 0)
+            {
+                std::println("{} file copied onto {} pages", replay.session, to_string(itch_file.backing()));
+            }
+
+            if (use_index)
+            {
+                if (!Session_Index::is_current(replay.itch_file_path, itch_file))
+                {
+                    const auto build_start{std::chrono::steady_clock::now()};
+                    Session_Index::build(replay.itch_file_path, itch_file);
+                    std::println("{} index built in {}",
+                                 replay.session,
+                                 std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - build_start));
+                }
+                replay.session_index.emplace(replay.itch_file_path);
+                std::println("{} index loaded", replay.session);
+            }
+
+            if (use_packet_file)
+            {
+                const auto payload_size{mtu - mold_udp_64::udp_header_size};
+                const std::chrono::microseconds max_packet_delay{max_packet_delay_us};
+                if (!Packet_File::is_current(replay.itch_file_path, itch_file, payload_size, max_packet_delay))
+                {
+                    const auto build_start{std::chrono::steady_clock::now()};
+                    Packet_File::build(replay.itch_file_path, itch_file, payload_size, max_packet_delay);
+                    std::println("{} packet file compiled in {}",
+                                 replay.session,
+                                 std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - build_start));
+                }
+                replay.packet_file.emplace(replay.itch_file_path);
+                std::println("{} packet file loaded, {} packets", replay.session, replay.packet_file->packets().size());
+            }
+
+            replay.filters.resize(1);
+            if (num_channels > 1 || !symbols.empty())
+            {
+                const Stock_Directory stock_directory{itch_file};
+                if (num_channels > 1)
+                {
+                    std::println("{} stock directory loaded, {} stocks across {} channels",
+                                 replay.session,
+                                 stock_directory.size(),
+                                 num_channels);
+                    replay.filters = Message_Filter::for_channels(num_channels,
+                                                                  stock_directory.assign_channels(num_channels, channel_map_path));
+                }
+                if (!symbols.empty())
+                {
+                    std::vector<std::uint16_t> locates;
+                    for (const auto& symbol : symbols)
+                    {
+                        if (const auto locate{stock_directory.locate(symbol)})
+                        {
+                            locates.push_back(*locate);
+                        }
+                        else
+                        {
+                            std::println(std::cerr, "{} has no stock directory entry for {}", replay.session, symbol);
+                        }
+                    }
+                    for (auto& filter : replay.filters)
+                    {
+                        filter.allow_locates(locates);
+                    }
+                    std::println("{} replaying {} of {} stocks", replay.session, locates.size(), stock_directory.size());
+                }
+            }
+            if (!msg_types.empty())
+            {
+                for (auto& filter : replay.filters)
+                {
+                    filter.allow_types(msg_types);
+                }
+            }
+        }
+
+        std::vector<Retransmission_Source> retrans_sources;
+        std::vector<std::unique_ptr<Message_Buffer>> msg_buffers;
+        std::vector<std::unique_ptr<Soup_Bin_Server>> soup_bin_servers;
+        std::vector<std::unique_ptr<Downstream_Server>> downstream_servers;
+        for (auto& replay : replays)
+        {
+            auto& itch_file{*replay.itch_file};
+            for (std::size_t channel = 0; channel < num_channels; ++channel)
+            {
+                const auto& filter{replay.filters[channel]};
+                // index sequence numbers count every message in the file so they only apply unfiltered
+                const auto* channel_index{replay.session_index && filter.accepts_all() ? &*replay.session_index : nullptr};
+
+                msg_buffers.push_back(std::make_unique<Message_Buffer>(itch_file,
+                                                                       filter,
+                                                                       channel_index,
+                                                                       page_backing,
+                                                                       replay.packet_file ? &*replay.packet_file : nullptr));
+                if (msg_buffers.back()->backing() != page_backing)
+                {
+                    std::println(std::cerr,
+                                 "{} channel {} message buffer fell back to {} pages",
+                                 replay.session,
+                                 channel,
+                                 to_string(msg_buffers.back()->backing()));
+                }
+                retrans_sources.push_back({replay.session,
+                                           channel,
+                                           static_cast<std::uint16_t>(retrans_port + static_cast<int>(channel)),
+                                           itch_file,
+                                           *msg_buffers.back(),
+                                           filter,
+                                           nullptr});
+                if (soup_bin_port != 0)
+                {
+                    const auto port{soup_bin_port + static_cast<int>(soup_bin_servers.size())};
+                    if (port > 65535)
+                    {
+                        throw std::invalid_argument(std::format("--soup-port {} leaves no port for {} channel {}",
+                                                                soup_bin_port,
+                                                                replay.session,
+                                                                channel));
+                    }
+                    soup_bin_servers.push_back(std::make_unique<Soup_Bin_Server>(replay.session,
+                                                                                 soup_bin_address,
+                                                                                 static_cast<std::uint16_t>(port),
+                                                                                 itch_file,
+                                                                                 *msg_buffers.back(),
+                                                                                 filter,
+                                                                                 metrics.add_soup_bin(replay.session, channel)));
+                    std::println("{} channel {} SoupBinTCP on port {}", replay.session, channel, port);
+                }
+                downstream_servers.push_back(std::make_unique<Downstream_Server>(
+                    replay.session,
+                    offset_group(replay.downstream_group, channel),
+                    static_cast<std::uint16_t>(replay.downstream_port + static_cast<int>(channel)),
+                    static_cast<std::uint8_t>(downstream_ttl),
+                    loopback,
+                    replay_speed,
+                    start_replay_at,
+                    rate_limiter,
+                    pacing_mode,
+                    std::chrono::microseconds{spin_threshold_us},
+                    send_batch_size,
+                    std::chrono::microseconds{max_batch_hold_us},
+                    zerocopy,
+                    mtu - mold_udp_64::udp_header_size,
+                    std::chrono::microseconds{max_packet_delay_us},
+                    tx_ring_interface,
+                    pipeline_depth,
+                    itch_file,
+                    *msg_buffers.back(),
+                    filter,
+                    metrics.add_downstream(replay.session, channel),
+                    soup_bin_port != 0 ? soup_bin_servers.back().get() : nullptr));
+
+                if (replay.packet_file)
+                {
+                    downstream_servers.back()->use_packet_file(*replay.packet_file);
+                }
+                if (replay.session_index)
+                {
+                    const auto checkpoint{replay.session_index->seek(start_replay_at)};
+                    // a filtered channel numbers its messages from the seek point
+                    downstream_servers.back()->seek(checkpoint.file_pos, channel_index ? checkpoint.seq_num : 1);
+                }
+            }
+        }
+
+        // one pool for every session, each downstream sender and SoupBinTCP server has its own thread
+        if (retrans_threads == 0 && !placement.retrans_cpus().empty())
+        {
+            retrans_threads = placement.retrans_cpus().size();
+        }
+        else if (retrans_threads == 0)
+        {
+            const auto num_senders{downstream_servers.size() * (pipeline_depth > 0 ? 2 : 1) + soup_bin_servers.size()};
+            retrans_threads = std::max<std::size_t>(
+                1,
+                std::max<std::size_t>(std::thread::hardware_concurrency(), num_senders) - num_senders);
+        }
+        const Retransmission_Server retrans_server{retrans_address,
+                                                   std::move(retrans_sources),
+                                                   metrics,
+                                                   retrans_engine,
+                                                   packet_cache_slots,
+                                                   retrans_threads,
+                                                   {retrans_client_rate,
+                                                    retrans_client_burst,
+                                                    std::chrono::microseconds{retrans_coalesce_us}},
+                                                   placement.retrans_cpus()};
+        std::println("Retransmission server started with {} workers", retrans_threads);
+
+        const Metrics_Exporter metrics_exporter{metrics,
+                                                metrics_socket_path,
+                                                metrics_file_path,
+                                                std::chrono::milliseconds{metrics_interval_ms}};
+
+        std::vector<std::exception_ptr> errors(downstream_servers.size());
+        {
+            std::vector<std::jthread> downstream_threads;
+            for (std::size_t i = 0; i < downstream_servers.size(); ++i)
+            {
+                // started from this thread so it stays off the senders' CPUs
+                if (downstream_servers[i]->pipelined())
+                {
+                    downstream_threads.emplace_back([&, i] { downstream_servers[i]->build(); });
+                }
+                downstream_threads.emplace_back([&, i] {
+                    try
+                    {
+                        placement.enter_downstream(i);
+                        downstream_servers[i]->start();
+                    }
+                    catch (...)
+                    {
+                        errors[i] = std::current_exception();
+                        downstream_servers[i]->abandon_build();
+                    }
+                });
+            }
+            std::println("Downstream server started");
+        }
         std::println("Downstream reached end of file, stopping retransmission server");
         retrans_server.stop();
+        // clients have had the downstream's end of session period to catch up
+        soup_bin_servers.clear();
+        std::print("{}", metrics.snapshot());
+        for (const auto& replay : replays)
+        {
+            replay.itch_file->check();
+        }
+        for (const auto& error : errors)
+        {
+            if (error)
+            {
+                std::rethrow_exception(error);
+            }
+        }
         return 0;
     }
     catch (const std::exception& ex)
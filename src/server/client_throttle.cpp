@@ -0,0 +1,78 @@
+#include "client_throttle.h"
+#include "config.h"
+
+#include <algorithm>
+
+Client_Throttle::Client_Throttle(const Client_Limits& limits)
+    : limits_{limits}
+{
+    // a bucket smaller than one response would never let anything through
+    limits_.burst = std::max(limits_.burst, 1.0);
+    limits_.coalesce_window = std::min(limits_.coalesce_window, std::chrono::microseconds{config::max_coalesce_window});
+}
+
+Client_Throttle::Verdict Client_Throttle::admit(const sockaddr_in& client,
+                                                std::uint64_t seq,
+                                                std::uint16_t msg_count,
+                                                time_point now)
+{
+    admitted_ = nullptr;
+    auto* state{find(client, now)};
+    if (state == nullptr)
+    {
+        return Verdict::throttled;
+    }
+
+    if (limits_.coalesce_window.count() > 0 && now - state->answered_at <= limits_.coalesce_window &&
+        seq == state->answered_seq && msg_count == state->answered_count)
+    {
+        return Verdict::coalesced;
+    }
+
+    if (limits_.rate > 0)
+    {
+        const std::chrono::duration<double> elapsed{now - state->refilled_at};
+        state->tokens = std::min(limits_.burst, state->tokens + elapsed.count() * limits_.rate);
+        state->refilled_at = now;
+        if (state->tokens < 1)
+        {
+            return Verdict::throttled;
+        }
+        state->tokens -= 1;
+    }
+    state->refilled_at = now;
+    admitted_ = state;
+    return Verdict::send;
+}
+
+void Client_Throttle::answered(std::uint64_t seq, std::uint16_t msg_count, time_point now)
+{
+    if (admitted_ != nullptr)
+    {
+        admitted_->answered_seq = seq;
+        admitted_->answered_count = msg_count;
+        admitted_->answered_at = now;
+    }
+}
+
+Client_Throttle::Client* Client_Throttle::find(const sockaddr_in& client, time_point now)
+{
+    const auto key{(std::uint64_t{client.sin_addr.s_addr} << 16U) | client.sin_port};
+    if (const auto it{clients_.find(key)}; it != clients_.end())
+    {
+        return &it->second;
+    }
+
+    // a flood of spoofed source addresses mustn't grow this without bound
+    if (clients_.size() >= config::throttle_max_clients)
+    {
+        std::erase_if(clients_, [now](const auto& entry) {
+            return now - entry.second.refilled_at > config::throttle_client_idle;
+        });
+        if (clients_.size() >= config::throttle_max_clients)
+        {
+            return nullptr;
+        }
+    }
+    return &clients_.try_emplace(key, Client{limits_.burst, now}).first->second;
+}
@@ -0,0 +1,62 @@
+#ifndef CLIENT_THROTTLE_H
+#define CLIENT_THROTTLE_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <netinet/in.h>
+
+// per client limits on retransmission requests, each zero disables its check
+struct Client_Limits
+{
+    double rate{0};  // responses per second
+    double burst{0}; // responses a client may get back to back
+    std::chrono::microseconds coalesce_window{0};
+
+    bool enabled() const { return rate > 0 || coalesce_window.count() > 0; }
+};
+
+// token bucket and last answered request per client address, for one worker's handler.
+// SO_REUSEPORT hashes a client to the same worker socket every time so per worker state
+// is per client. Only a request identical to the one answered for that client within the
+// coalesce window is dropped, it is a duplicate of a request whose response is still in
+// flight. The window is capped at config::max_coalesce_window, well under a client's retry
+// interval, so a re-request after a lost response is always answered
+class Client_Throttle
+{
+  public:
+    enum class Verdict
+    {
+        send,
+        throttled,
+        coalesced
+    };
+
+    using time_point = std::chrono::steady_clock::time_point;
+
+    explicit Client_Throttle(const Client_Limits& limits);
+
+    Verdict admit(const sockaddr_in& client, std::uint64_t seq, std::uint16_t msg_count, time_point now);
+
+    // the request last admitted was answered
+    void answered(std::uint64_t seq, std::uint16_t msg_count, time_point now);
+
+  private:
+    struct Client
+    {
+        double tokens;
+        time_point refilled_at;
+        std::uint64_t answered_seq{};
+        std::uint16_t answered_count{};
+        time_point answered_at{};
+    };
+
+    Client* find(const sockaddr_in& client, time_point now);
+
+    Client_Limits limits_;
+    std::unordered_map<std::uint64_t, Client> clients_;
+    Client* admitted_{nullptr};
+};
+
+#endif
@@ -1,15 +1,18 @@
 #include "downstream_server.h"
+#include "config.h"
 #include "itch.h"
 #include "mold_udp_64.h"
-#include "nasdaq.h"
 #include <arpa/inet.h>
 #include <chrono>
 #include <print>
 #include <stdexcept>
 #include <sys/socket.h>
+#include <linux/errqueue.h>
+#include <poll.h>
 #include <iostream>
 #include <thread>
 #include <ranges>
+#include <utility>
 
 Downstream_Server::Downstream_Server(std::string_view session,
                                      std::string_view group,
@@ -17,15 +20,55 @@ Downstream_Server::Downstream_Server(std::string_view session,
                                      std::uint8_t ttl,
                                      bool loopback,
                                      double replay_speed,
-                                     nasdaq::Market_Phase start_phase,
-                                     jam_utils::M_Map& itch_file,
-                                     Message_Buffer& msg_buffer)
-    : res_ctx_{session},
-      replay_ctx_{replay_speed, nasdaq::market_phase_to_timestamp(start_phase)},
+                                     std::chrono::nanoseconds start_replay_at,
+                                     std::optional<Rate_Limiter> rate_limiter,
+                                     Pacing_Mode pacing_mode,
+                                     std::chrono::microseconds spin_threshold,
+                                     std::size_t send_batch_size,
+                                     std::chrono::microseconds max_batch_hold,
+                                     bool zerocopy,
+                                     std::size_t payload_size,
+                                     std::chrono::nanoseconds max_packet_delay,
+                                     std::string_view tx_ring_interface,
+                                     std::size_t pipeline_depth,
+                                     Itch_File& itch_file,
+                                     Message_Buffer& msg_buffer,
+                                     const Message_Filter& filter,
+                                     Downstream_Metrics& metrics,
+                                     Soup_Bin_Server* soup_bin_server)
+    : batch_{session,
+             send_batch_size,
+             zerocopy ? config::zerocopy_header_ring_size : send_batch_size,
+             payload_size,
+             max_batch_hold},
+      zerocopy_{zerocopy},
+      replay_ctx_{replay_speed, start_replay_at},
+      pace_by_last_msg_{max_packet_delay.count() > 0},
+      rate_limiter_{std::move(rate_limiter)},
+      pacer_{pacing_mode, spin_threshold},
       itch_file_{itch_file},
+      file_reader_{itch_file.add_reader()},
       msg_buffer_{msg_buffer},
+      packetizer_{itch_file, filter, payload_size, max_packet_delay},
+      filter_{filter},
+      metrics_{metrics},
+      soup_bin_server_{soup_bin_server},
       sock_{socket(AF_INET, SOCK_DGRAM, 0)}
 {
+    if (send_batch_size == 0 || send_batch_size > config::max_send_batch)
+    {
+        throw std::invalid_argument(std::format("send batch size {} outside [1, {}]", send_batch_size, config::max_send_batch));
+    }
+
+    if (constexpr auto min_payload_size{sizeof(mold_udp_64::Downstream_Header) + itch::len_prefix_size + itch::max_msg_len};
+        payload_size < min_payload_size || payload_size > mold_udp_64::max_jumbo_mtu_size - mold_udp_64::udp_header_size)
+    {
+        throw std::invalid_argument(std::format("payload size {} outside [{}, {}]",
+                                                payload_size,
+                                                min_payload_size,
+                                                mold_udp_64::max_jumbo_mtu_size - mold_udp_64::udp_header_size));
+    }
+
     constexpr auto opt{1};
     if (setsockopt(sock_.fd(), SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
         setsockopt(sock_.fd(), IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0 ||
@@ -34,6 +77,18 @@ Downstream_Server::Downstream_Server(std::string_view session,
         throw std::system_error(errno, std::system_category());
     }
 
+#ifdef DEBUG_NO_NETWORK
+    // completions would never arrive and the header ring would wait for them forever
+    if (zerocopy)
+    {
+        throw std::invalid_argument("MSG_ZEROCOPY needs the sends compiled out by DEBUG_NO_NETWORK");
+    }
+#endif
+    if (zerocopy && setsockopt(sock_.fd(), SOL_SOCKET, SO_ZEROCOPY, &opt, sizeof(opt)) < 0)
+    {
+        throw std::system_error(errno, std::system_category(), "SO_ZEROCOPY");
+    }
+
     addr_.sin_family = AF_INET;
     addr_.sin_port = htons(port);
 
@@ -45,107 +100,408 @@ Downstream_Server::Downstream_Server(std::string_view session,
     {
         throw std::system_error(errno, std::system_category());
     }
+
+    if (!tx_ring_interface.empty())
+    {
+        if (zerocopy)
+        {
+            throw std::invalid_argument("MSG_ZEROCOPY doesn't apply to the packet ring, frames are always copied into it");
+        }
+        if (loopback)
+        {
+            throw std::invalid_argument("multicast loopback doesn't apply to the packet ring, its frames skip the IP stack");
+        }
+        // bound so the frames carry a source port of this process's own, as sendmmsg() would pick
+        sockaddr_in source{};
+        source.sin_family = AF_INET;
+        socklen_t source_len{sizeof(source)};
+        if (bind(sock_.fd(), reinterpret_cast<const sockaddr*>(&source), sizeof(source)) < 0 ||
+            getsockname(sock_.fd(), reinterpret_cast<sockaddr*>(&source), &source_len) < 0)
+        {
+            throw std::system_error(errno, std::system_category(), "binding the downstream source port");
+        }
+        packet_ring_.emplace(tx_ring_interface, addr_, source.sin_port, ttl, payload_size);
+    }
+
+    if (pipeline_depth > 0)
+    {
+        pipeline_.emplace(pipeline_depth, Built_Packet{mold_udp_64::Response_Context{session, payload_size}, {}, false});
+    }
+
+    for (std::size_t i = 0; i < send_batch_size; ++i)
+    {
+        batch_.msgs[i].msg_hdr.msg_name = &addr_;
+        batch_.msgs[i].msg_hdr.msg_namelen = sizeof(addr_);
+        batch_.msgs[i].msg_hdr.msg_iov = &batch_.iovs[i * batch_.packet_iovs];
+    }
 }
 
-void Downstream_Server::start()
+void Downstream_Server::seek(std::size_t file_pos, std::uint64_t seq_num)
+{
+    file_pos_ = file_pos;
+    mold_seq_num_ = seq_num;
+}
+
+void Downstream_Server::use_packet_file(const Packet_File& packet_file)
+{
+    if (!filter_.accepts_all())
+    {
+        throw std::invalid_argument("a packet file is compiled for every message, it can't be sent on a filtered channel");
+    }
+    if (pipeline_)
+    {
+        throw std::invalid_argument("a packet file has nothing left to build, it doesn't take a pipeline");
+    }
+    packet_file_ = &packet_file;
+}
+
+void Downstream_Server::build()
 {
-    while (res_ctx_.file_pos < itch_file_.len())
+    try
     {
-        fill_buffer();
-        if (replay_ctx_.current_timestamp < replay_ctx_.start_replay_at)
+        while (file_pos_ < itch_file_.ensure(file_pos_ + 1))
         {
-            continue;
+            auto* built{pipeline_->claim()};
+            if (built == nullptr)
+            {
+                return; // the sender gave up
+            }
+            built->timestamp = fill_buffer(built->packet);
+            if (built->packet.header.msg_count == 0 || built->timestamp < replay_ctx_.start_replay_at)
+            {
+                continue;
+            }
+            pipeline_->publish();
         }
-        handle_timing();
-        send_buffer();
     }
-    end_of_session();
+    catch (...)
+    {
+        build_error_ = std::current_exception();
+    }
+    if (auto* built{pipeline_->claim()}; built != nullptr)
+    {
+        built->end = true;
+        pipeline_->publish();
+    }
 }
 
-void Downstream_Server::fill_buffer()
+void Downstream_Server::abandon_build()
 {
-    res_ctx_.header.msg_count = 0;
-    res_ctx_.header.sequence_num = htobe64(mold_seq_num_);
+    if (pipeline_)
+    {
+        pipeline_->close();
+    }
+}
 
-    res_ctx_.buff_len = sizeof(mold_udp_64::Downstream_Header);
+void Downstream_Server::start()
+{
+    if (packet_file_ != nullptr)
+    {
+        send_compiled();
+    }
+    else if (pipeline_)
+    {
+        try
+        {
+            send_built();
+        }
+        catch (...)
+        {
+            abandon_build();
+            throw;
+        }
+    }
+    else
+    {
+        while (file_pos_ < itch_file_.ensure(file_pos_ + 1))
+        {
+            const auto timestamp{fill_buffer(batch_.packets[batch_.len])};
+            // a filtered channel can reach eof with nothing left to send
+            if (batch_.packets[batch_.len].header.msg_count == 0 || timestamp < replay_ctx_.start_replay_at)
+            {
+                continue;
+            }
+            replay_ctx_.current_timestamp = timestamp;
+            send_packet();
+        }
+    }
+    flush_batch();
+    if (rate_limiter_)
+    {
+        std::println("{} channel {} achieved {:.1f} {} against a target of {:.1f} over the last step",
+                     metrics_.session,
+                     metrics_.channel,
+                     rate_limiter_->achieved(pacer_.now()),
+                     to_string(rate_limiter_->unit()),
+                     rate_limiter_->target());
+    }
+    if (soup_bin_server_ != nullptr)
+    {
+        soup_bin_server_->end_of_session();
+    }
+    end_of_session();
+}
 
-    while (res_ctx_.file_pos < itch_file_.len())
+void Downstream_Server::send_built()
+{
+    while (true)
     {
-        if (res_ctx_.file_pos + itch::len_prefix_size > itch_file_.len())
+        auto* built{pipeline_->try_front()};
+        if (built == nullptr)
         {
-            throw std::runtime_error("unexpected trailing bytes at eof");
+            metrics_.pipeline_starved.add();
+            built = &pipeline_->front();
         }
+        metrics_.pipeline_occupancy.set(static_cast<std::int64_t>(pipeline_->size()));
+        if (built->end)
+        {
+            pipeline_->pop();
+            break;
+        }
+        // the builder gets the sent packet's context back to fill, nothing is copied
+        std::swap(batch_.packets[batch_.len], built->packet);
+        replay_ctx_.current_timestamp = built->timestamp;
+        pipeline_->pop();
+        send_packet();
+    }
+    if (build_error_)
+    {
+        std::rethrow_exception(build_error_);
+    }
+}
 
-        std::uint16_t len_prefix;
-        std::memcpy(&len_prefix, itch_file_.at(res_ctx_.file_pos), itch::len_prefix_size);
-        len_prefix = ntohs(len_prefix);
+// the packet boundaries were all found when compiling so there is nothing to parse, each
+// packet is its header plus one slice of the file
+void Downstream_Server::send_compiled()
+{
+    const auto packets{packet_file_->packets()};
+    auto i{packet_file_->seek(replay_ctx_.start_replay_at)};
+    if (i < packets.size())
+    {
+        // what was skipped can still be retransmitted
+        msg_buffer_.publish(packets[i].seq_num - 1);
+    }
+    for (; i < packets.size(); ++i)
+    {
+        const auto& packet{packets[i]};
+        auto& res_ctx{batch_.packets[batch_.len]};
+        res_ctx.header.sequence_num = htobe64(packet.seq_num);
+        res_ctx.header.msg_count = static_cast<std::uint16_t>(packet.msg_count);
+        res_ctx.clear_payload();
+        res_ctx.append(packet.file_pos, packet.payload_len);
+        itch_file_.advance(file_reader_, packet.file_pos + packet.payload_len);
+
+        mold_seq_num_ = packet.seq_num + packet.msg_count;
+        msg_buffer_.publish(mold_seq_num_ - 1);
+        replay_ctx_.current_timestamp = std::chrono::nanoseconds{packet.timestamp};
+        send_packet();
+    }
+}
+
+void Downstream_Server::send_packet()
+{
+    if (rate_limiter_)
+    {
+        handle_rate();
+    }
+    else
+    {
+        handle_timing();
+    }
+    queue_buffer();
+}
+
+std::chrono::nanoseconds Downstream_Server::fill_buffer(mold_udp_64::Response_Context& res_ctx)
+{
+    res_ctx.header.sequence_num = htobe64(mold_seq_num_);
+    res_ctx.file_pos = file_pos_;
+
+    if (!packetizer_.fill(res_ctx, UINT16_MAX, &msg_buffer_, mold_seq_num_))
+    {
+        throw std::runtime_error("ITCH message truncated at eof");
+    }
 
-        const std::size_t total_msg_len{itch::len_prefix_size + len_prefix};
+    std::chrono::nanoseconds timestamp{};
+    if (res_ctx.header.msg_count > 0)
+    {
+        timestamp = std::chrono::nanoseconds{
+            itch::extract_timestamp(itch_file_.at(pace_by_last_msg_ ? res_ctx.last_msg_pos : res_ctx.runs[0].pos))};
+    }
+    file_pos_ = res_ctx.file_pos;
+    mold_seq_num_ += res_ctx.header.msg_count;
+    itch_file_.advance(file_reader_, file_pos_);
+    return timestamp;
+}
 
-        if (res_ctx_.file_pos + total_msg_len > itch_file_.len())
+mold_udp_64::Downstream_Header& Downstream_Server::next_header()
+{
+    if (!zerocopy_.enabled)
+    {
+        return batch_.headers[batch_.len];
+    }
+
+    const auto ring_size{batch_.headers.size()};
+    if (zerocopy_.queued - zerocopy_.completed >= ring_size / 2)
+    {
+        reap_zerocopy(zerocopy_.queued - zerocopy_.completed >= ring_size);
+    }
+    return batch_.headers[zerocopy_.queued++ % ring_size];
+}
+
+void Downstream_Server::reap_zerocopy(bool block)
+{
+    if (block)
+    {
+        pollfd pfd{.fd = sock_.fd(), .events = 0, .revents = 0}; // POLLERR is always reported
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
         {
-            throw std::runtime_error("ITCH message exceeds file size");
+            std::perror("poll");
         }
+    }
+
+    while (true)
+    {
+        std::array<char, CMSG_SPACE(sizeof(sock_extended_err))> control{};
+        msghdr msg{};
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
 
-        if (res_ctx_.buff_len + total_msg_len > res_ctx_.buff.size())
+        if (recvmsg(sock_.fd(), &msg, MSG_ERRQUEUE) < 0)
         {
-            break;
+            if (errno != EAGAIN && errno != EINTR)
+            {
+                std::perror("recvmsg MSG_ERRQUEUE");
+            }
+            return;
         }
 
-        if (res_ctx_.header.msg_count == 0)
+        for (cmsghdr* cmsg{CMSG_FIRSTHDR(&msg)}; cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
         {
-            replay_ctx_.current_timestamp = std::chrono::nanoseconds{
-                itch::extract_timestamp(itch_file_.at(res_ctx_.file_pos))};
+            if (cmsg->cmsg_level != SOL_IP || cmsg->cmsg_type != IP_RECVERR)
+            {
+                continue;
+            }
+            sock_extended_err err{};
+            std::memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            // ee_info..ee_data is the inclusive range of completed send ids, completions are in order for udp
+            if (err.ee_origin == SO_EE_ORIGIN_ZEROCOPY && err.ee_errno == 0)
+            {
+                zerocopy_.completed = err.ee_data + 1;
+            }
         }
+    }
+}
+
+void Downstream_Server::queue_buffer()
+{
+    auto& res_ctx{batch_.packets[batch_.len]};
+    auto& header{next_header()};
+    header = res_ctx.header;
+    header.msg_count = htons(res_ctx.header.msg_count);
 
-        std::memcpy(&res_ctx_.buff[res_ctx_.buff_len], itch_file_.at(res_ctx_.file_pos), total_msg_len);
+    auto* iov{&batch_.iovs[batch_.len * batch_.packet_iovs]};
+    batch_.msgs[batch_.len].msg_hdr.msg_iovlen = res_ctx.fill_iov(iov, itch_file_.at(0));
+    iov[0].iov_base = &header;
 
-        msg_buffer_.push(mold_seq_num_, res_ctx_.file_pos);
+    const auto now{pacer_.now()};
+    if (batch_.len++ == 0)
+    {
+        batch_.flush_deadline = now + batch_.max_hold;
+    }
 
-        res_ctx_.buff_len += total_msg_len;
-        res_ctx_.file_pos += total_msg_len;
-        ++res_ctx_.header.msg_count;
-        ++mold_seq_num_;
+    if (batch_.len == batch_.packets.size() || now >= batch_.flush_deadline)
+    {
+        flush_batch();
     }
 }
 
-void Downstream_Server::send_buffer()
+void Downstream_Server::flush_batch()
 {
-    res_ctx_.header.msg_count = htons(res_ctx_.header.msg_count);
-    std::memcpy(res_ctx_.buff.data(), &res_ctx_.header, sizeof(mold_udp_64::Downstream_Header));
+    if (batch_.len == 0)
+    {
+        return;
+    }
 #ifndef DEBUG_NO_NETWORK
-#ifdef PROFILE_SEND_EVERY
-    static auto count{0};
-    static auto total_duration{std::chrono::microseconds{0}};
-    constexpr int sample_rate{PROFILE_SEND_EVERY};
-    auto start{std::chrono::high_resolution_clock::now()};
+    const auto start{pacer_.now()};
+    std::uint64_t msgs{0};
+    std::uint64_t bytes{0};
+    const auto sent{packet_ring_ ? send_ring(msgs, bytes) : send_socket(msgs, bytes)};
+    metrics_.send_latency.record(pacer_.now() - start);
+    if (metrics_.packets_sent.load() == 0 && sent > 0)
+    {
+        const auto time_to_first_packet{std::chrono::steady_clock::now() - metrics_.started_at};
+        metrics_.time_to_first_packet.set(std::chrono::nanoseconds{time_to_first_packet}.count());
+        std::println("{} channel {} first packet sent {} after startup",
+                     metrics_.session,
+                     metrics_.channel,
+                     std::chrono::duration_cast<std::chrono::milliseconds>(time_to_first_packet));
+    }
+    metrics_.packets_sent.add(sent);
+    metrics_.msgs_sent.add(msgs);
+    metrics_.bytes_sent.add(bytes);
 #endif
-    if (const ssize_t bytes_sent{sendto(sock_.fd(),
-                                        res_ctx_.buff.data(),
-                                        res_ctx_.buff_len,
-                                        0,
-                                        reinterpret_cast<const sockaddr*>(&addr_),
-                                        sizeof(addr_))};
-        bytes_sent < 0)
+    if (soup_bin_server_ != nullptr)
     {
-        std::perror("sendto");
+        const auto& last{batch_.packets[batch_.len - 1].header};
+        soup_bin_server_->publish(be64toh(last.sequence_num) + last.msg_count);
     }
-    else if (bytes_sent != static_cast<ssize_t>(res_ctx_.buff_len))
+    batch_.len = 0;
+}
+
+std::size_t Downstream_Server::send_socket(std::uint64_t& msgs, std::uint64_t& bytes)
+{
+    std::size_t sent{0};
+    while (sent < batch_.len)
     {
-        std::println(std::cerr, "sendto sent only {} of {} bytes", bytes_sent, res_ctx_.buff_len);
+        const int ret{sendmmsg(sock_.fd(),
+                               &batch_.msgs[sent],
+                               static_cast<unsigned int>(batch_.len - sent),
+                               zerocopy_.enabled ? MSG_ZEROCOPY : 0)};
+        if (ret < 0)
+        {
+            std::perror("sendmmsg");
+            metrics_.send_errors.add(batch_.len - sent);
+            zerocopy_.queued -= static_cast<std::uint32_t>(zerocopy_.enabled ? batch_.len - sent : 0);
+            break;
+        }
+        for (std::size_t i = sent; i < sent + static_cast<std::size_t>(ret); ++i)
+        {
+            if (const auto packet_len{batch_.packets[i].packet_len()}; batch_.msgs[i].msg_len != packet_len)
+            {
+                std::println(std::cerr, "sendmmsg sent only {} of {} bytes", batch_.msgs[i].msg_len, packet_len);
+            }
+            msgs += batch_.packets[i].header.msg_count;
+            bytes += batch_.msgs[i].msg_len;
+        }
+        sent += static_cast<std::size_t>(ret);
     }
-#ifdef PROFILE_SEND_EVERY
-    auto end{std::chrono::high_resolution_clock::now()};
-    total_duration += std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-    if (++count >= sample_rate)
+    return sent;
+}
+
+// the whole batch is copied into the ring and handed over with one send()
+std::size_t Downstream_Server::send_ring(std::uint64_t& msgs, std::uint64_t& bytes)
+{
+    std::size_t sent{0};
+    for (std::size_t i = 0; i < batch_.len; ++i)
     {
-        std::println("PROFILE_SEND avg: {} μs", total_duration.count() / sample_rate);
-        std::cout.flush(); // cbf doing proper logging so pipe to file and sigint when done lol and this flush will handle
-        count = 0;
-        total_duration = std::chrono::microseconds{0};
+        const auto& hdr{batch_.msgs[i].msg_hdr};
+        if (!packet_ring_->queue(hdr.msg_iov, hdr.msg_iovlen))
+        {
+            std::println(std::cerr, "packet ring has no room for packet {}", be64toh(batch_.packets[i].header.sequence_num));
+            metrics_.send_errors.add();
+            continue;
+        }
+        msgs += batch_.packets[i].header.msg_count;
+        bytes += batch_.packets[i].packet_len();
+        ++sent;
     }
-#endif
-#endif
+    if (const auto dropped{packet_ring_->flush()}; dropped > 0)
+    {
+        std::println(std::cerr, "packet ring dropped {} malformed frames", dropped);
+        metrics_.send_errors.add(dropped);
+        sent -= dropped;
+    }
+    return sent;
 }
 
 void Downstream_Server::handle_timing()
@@ -157,28 +513,78 @@ void Downstream_Server::handle_timing()
     }
 
     const std::chrono::nanoseconds elapsed{replay_ctx_.current_timestamp - replay_ctx_.first_timestamp};
-    const auto delay{replay_ctx_.replay_start_time + (elapsed / replay_ctx_.speed)};
+    const auto delay{replay_ctx_.replay_start_time +
+                     std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed / replay_ctx_.speed)};
 
 #ifndef DEBUG_NO_SLEEP
-    std::this_thread::sleep_until(delay);
+    // queued packets may not be held past their deadline waiting for this one
+    if (batch_.len > 0 && delay > batch_.flush_deadline)
+    {
+        flush_batch();
+    }
+    const auto lateness{pacer_.wait_until(delay)};
+    metrics_.pacing_lateness.record(lateness);
+    metrics_.replay_lag.set(lateness.count());
 #endif
+    metrics_.replay_timestamp.set(replay_ctx_.current_timestamp.count());
+}
+
+void Downstream_Server::handle_rate()
+{
+    auto& limiter{*rate_limiter_};
+    const auto& res_ctx{batch_.packets[batch_.len]};
+    const auto step{limiter.step()};
+    const auto due{limiter.reserve(res_ctx.header.msg_count, res_ctx.packet_len(), pacer_.now())};
+    if (limiter.step() != step)
+    {
+        std::println("{} channel {} achieved {:.1f} {} against a target of {:.1f}, {} {:.1f}",
+                     metrics_.session,
+                     metrics_.channel,
+                     limiter.previous_achieved(),
+                     to_string(limiter.unit()),
+                     limiter.previous_target(),
+                     limiter.target() > limiter.previous_target() ? "stepping up to" : "holding at",
+                     limiter.target());
+    }
+
+#ifndef DEBUG_NO_SLEEP
+    if (batch_.len > 0 && due > batch_.flush_deadline)
+    {
+        flush_batch();
+    }
+    const auto lateness{pacer_.wait_until(due)};
+    metrics_.pacing_lateness.record(lateness);
+    metrics_.replay_lag.set(lateness.count());
+#endif
+    metrics_.replay_timestamp.set(replay_ctx_.current_timestamp.count());
+    metrics_.rate_target.set(static_cast<std::int64_t>(limiter.target_per_second()));
+    metrics_.rate_achieved.set(static_cast<std::int64_t>(limiter.achieved_per_second(due)));
 }
 
 void Downstream_Server::end_of_session()
 {
 #if !(defined(DEBUG_NO_NETWORK) || defined(DEBUG_NO_SLEEP))
-    res_ctx_.header.msg_count = mold_udp_64::end_of_session_flag;
-    res_ctx_.header.sequence_num = htobe64(mold_seq_num_);
+    auto& header{batch_.packets.front().header};
+    header.msg_count = mold_udp_64::end_of_session_flag;
+    header.sequence_num = htobe64(mold_seq_num_);
 
     std::array<std::byte, sizeof(mold_udp_64::Downstream_Header)> end_session_buff{};
-    std::memcpy(end_session_buff.data(), &res_ctx_.header, sizeof(mold_udp_64::Downstream_Header));
+    std::memcpy(end_session_buff.data(), &header, sizeof(mold_udp_64::Downstream_Header));
 
     const auto start_time{std::chrono::high_resolution_clock::now()};
     for (auto second : std::views::iota(0z, mold_udp_64::end_of_session_transmission_duration.count()))
     {
         const auto send_time{start_time + std::chrono::seconds(second)};
         std::this_thread::sleep_until(send_time);
-        if (const ssize_t bytes_sent{sendto(sock_.fd(),
+        if (packet_ring_)
+        {
+            const iovec iov{end_session_buff.data(), end_session_buff.size()};
+            if (!packet_ring_->queue(&iov, 1) || packet_ring_->flush() > 0)
+            {
+                std::println(std::cerr, "packet ring failed sending end of session");
+            }
+        }
+        else if (const ssize_t bytes_sent{sendto(sock_.fd(),
                                             end_session_buff.data(),
                                             sizeof(mold_udp_64::Downstream_Header),
                                             0,
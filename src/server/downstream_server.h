@@ -1,13 +1,24 @@
 #ifndef DOWNSTREAM_SERVER_H
 #define DOWNSTREAM_SERVER_H
 
+#include "itch_file.h"
 #include "message_buffer.h"
+#include "message_filter.h"
+#include "metrics.h"
 #include "mold_udp_64.h"
-#include "nasdaq.h"
-
-#include "jamutils/M_Map.h"
+#include "pacer.h"
+#include "packet_file.h"
+#include "packet_ring.h"
+#include "packetizer.h"
+#include "rate_limiter.h"
+#include "soup_bin_server.h"
+#include "spsc_ring.h"
 
 #include <chrono>
+#include <exception>
+#include <optional>
+#include <vector>
+#include <sys/socket.h>
 
 class Downstream_Server
 {
@@ -18,40 +29,142 @@ class Downstream_Server
                       std::uint8_t ttl,
                       bool loopback,
                       double replay_speed,
-                      nasdaq::Market_Phase start_phase,
-                      jam_utils::M_Map& itch_file,
-                      Message_Buffer& msg_buffer);
+                      std::chrono::nanoseconds start_replay_at,
+                      std::optional<Rate_Limiter> rate_limiter,
+                      Pacing_Mode pacing_mode,
+                      std::chrono::microseconds spin_threshold,
+                      std::size_t send_batch_size,
+                      std::chrono::microseconds max_batch_hold,
+                      bool zerocopy,
+                      std::size_t payload_size,
+                      std::chrono::nanoseconds max_packet_delay,
+                      std::string_view tx_ring_interface,
+                      std::size_t pipeline_depth,
+                      Itch_File& itch_file,
+                      Message_Buffer& msg_buffer,
+                      const Message_Filter& filter,
+                      Downstream_Metrics& metrics,
+                      Soup_Bin_Server* soup_bin_server = nullptr);
+
+    // resume from a known message boundary instead of the start of the file
+    void seek(std::size_t file_pos, std::uint64_t seq_num);
+
+    // send packet_file's packets from the first due at the start time instead of parsing and
+    // packetizing the file, it must have been compiled for this payload size and delay bound
+    // and the channel unfiltered. msg_buffer must look messages up in it too
+    void use_packet_file(const Packet_File& packet_file);
+
+    // with a pipeline, build() parses and packetizes on its own thread while start() only
+    // paces and sends what it built, so parsing stalls (page faults, cache misses) are
+    // absorbed by the packets built ahead instead of delaying sends
+    bool pipelined() const { return pipeline_.has_value(); }
+    void build();
+    // lets build() return early when the sender won't be taking any more packets
+    void abandon_build();
+
     void start();
 
   private:
-    void fill_buffer();
-    void send_buffer();
+    // a packet built ahead with the timestamp it is paced by, or the end of the file
+    struct Built_Packet
+    {
+        mold_udp_64::Response_Context packet;
+        std::chrono::nanoseconds timestamp{};
+        bool end{false};
+    };
+
+    std::chrono::nanoseconds fill_buffer(mold_udp_64::Response_Context& res_ctx);
+    void send_built();
+    void send_compiled();
+    void send_packet();
+    void queue_buffer();
+    void flush_batch();
+    std::size_t send_ring(std::uint64_t& msgs, std::uint64_t& bytes);
+    std::size_t send_socket(std::uint64_t& msgs, std::uint64_t& bytes);
     void handle_timing();
+    void handle_rate();
     void end_of_session();
     struct Replay_Context
     {
         double speed;
         std::chrono::nanoseconds start_replay_at;
-        std::chrono::high_resolution_clock::time_point replay_start_time;
+        Pacer::time_point replay_start_time;
         std::chrono::nanoseconds first_timestamp{};
         std::chrono::nanoseconds current_timestamp{};
         Replay_Context(double speed_, std::chrono::nanoseconds start_replay_at_)
             : speed{speed_},
               start_replay_at{start_replay_at_},
               replay_start_time{
-                  std::chrono::high_resolution_clock::now()}
+                  std::chrono::steady_clock::now()}
         {
         }
     };
 
-    mold_udp_64::Response_Context res_ctx_;
+    // packets which are already due are queued here and sent with one sendmmsg(), each as a
+    // header iovec plus iovecs over the payload runs in the mapping
+    struct Batch_Context
+    {
+        std::vector<mold_udp_64::Response_Context> packets;
+        std::vector<mold_udp_64::Downstream_Header> headers;
+        std::size_t packet_iovs; // iovecs reserved per packet
+        std::vector<iovec> iovs;
+        std::vector<mmsghdr> msgs;
+        std::size_t len{};
+        std::chrono::microseconds max_hold;
+        Pacer::time_point flush_deadline;
+        Batch_Context(std::string_view session,
+                      std::size_t size,
+                      std::size_t header_ring_size,
+                      std::size_t payload_size,
+                      std::chrono::microseconds max_hold_)
+            : packets(size, mold_udp_64::Response_Context{session, payload_size}),
+              headers(header_ring_size),
+              packet_iovs{mold_udp_64::max_runs(payload_size) + 1},
+              iovs(size * packet_iovs),
+              msgs(size),
+              max_hold{max_hold_}
+        {
+        }
+    };
+
+    // with MSG_ZEROCOPY the kernel pins the iovecs until it reports completion on the error
+    // queue, so headers come from a ring which is only reused once their send has completed
+    struct Zerocopy_Context
+    {
+        bool enabled;
+        std::uint32_t queued{};
+        std::uint32_t completed{};
+    };
+
+    mold_udp_64::Downstream_Header& next_header();
+    void reap_zerocopy(bool block);
+
+    Batch_Context batch_;
+    Zerocopy_Context zerocopy_;
     Replay_Context replay_ctx_;
-    jam_utils::M_Map& itch_file_;
+    // with a packet delay bound a packet is sent at its last message's time, as a packetizer
+    // flushing on a timer would have, rather than ahead of its later messages at its first's
+    bool pace_by_last_msg_;
+    std::optional<Rate_Limiter> rate_limiter_; // paces to a fixed rate instead of the timestamps
+    Pacer pacer_;
+    Itch_File& itch_file_;
+    std::size_t file_reader_; // this channel's position for the prefetcher
     Message_Buffer& msg_buffer_;
+    Packetizer packetizer_;
+    const Message_Filter& filter_;
+    Downstream_Metrics& metrics_;
+    Soup_Bin_Server* soup_bin_server_; // told how far the multicast has got, if serving SoupBinTCP too
     jam_utils::FD sock_;
     sockaddr_in addr_{};
+    std::optional<Packet_Ring> packet_ring_; // replaces sock_ for packets when sending on an interface's tx ring
 
+    // file_pos_ and mold_seq_num_ belong to the builder when pipelined, the sender reads
+    // mold_seq_num_ only once it has seen the end
+    std::size_t file_pos_{};
     std::uint64_t mold_seq_num_{1};
+    std::optional<Spsc_Ring<Built_Packet>> pipeline_;
+    const Packet_File* packet_file_{};
+    std::exception_ptr build_error_;
 };
 
-#endif
\ No newline at end of file
+#endif
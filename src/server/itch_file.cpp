@@ -0,0 +1,353 @@
+#include "itch_file.h"
+#include "config.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+#include <algorithm>
+#include <cerrno>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <print>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+namespace
+{
+class Gzip_Reader
+{
+  public:
+    explicit Gzip_Reader(const std::filesystem::path& path)
+        : gz_{gzopen(path.c_str(), "rb")}
+    {
+        if (gz_ == nullptr)
+        {
+            throw std::runtime_error(std::format("could not open {}", path.string()));
+        }
+        gzbuffer(gz_.get(), 1U << 20U);
+    }
+
+    std::size_t read(std::byte* out, std::size_t len)
+    {
+        const auto ret{gzread(gz_.get(), out, static_cast<unsigned>(len))};
+        // a truncated stream reads as eof with the error set
+        int errnum{Z_OK};
+        const char* error{gzerror(gz_.get(), &errnum)};
+        if (ret < 0 || errnum != Z_OK)
+        {
+            throw std::runtime_error(std::format("gzread: {}", error));
+        }
+        return static_cast<std::size_t>(ret);
+    }
+
+  private:
+    struct Closer
+    {
+        void operator()(gzFile gz) const { gzclose(gz); }
+    };
+
+    std::unique_ptr<gzFile_s, Closer> gz_;
+};
+
+#ifdef WITH_ZSTD
+class Zstd_Reader
+{
+  public:
+    explicit Zstd_Reader(const std::filesystem::path& path)
+        : in_{path, std::ios::binary},
+          ctx_{ZSTD_createDStream()},
+          in_buf_(ZSTD_DStreamInSize())
+    {
+        if (!in_)
+        {
+            throw std::runtime_error(std::format("could not open {}", path.string()));
+        }
+    }
+
+    std::size_t read(std::byte* out, std::size_t len)
+    {
+        ZSTD_outBuffer output{out, len, 0};
+        while (output.pos < output.size)
+        {
+            if (input_.pos == input_.size && !in_eof_)
+            {
+                in_.read(reinterpret_cast<char*>(in_buf_.data()), static_cast<std::streamsize>(in_buf_.size()));
+                input_ = {in_buf_.data(), static_cast<std::size_t>(in_.gcount()), 0};
+                in_eof_ = input_.size == 0;
+            }
+
+            const auto before{output.pos};
+            const auto ret{ZSTD_decompressStream(ctx_.get(), &output, &input_)};
+            if (ZSTD_isError(ret) != 0U)
+            {
+                throw std::runtime_error(std::format("ZSTD_decompressStream: {}", ZSTD_getErrorName(ret)));
+            }
+            if (in_eof_ && input_.pos == input_.size && output.pos == before)
+            {
+                if (ret != 0)
+                {
+                    throw std::runtime_error("zstd stream truncated");
+                }
+                break;
+            }
+        }
+        return output.pos;
+    }
+
+  private:
+    struct Freer
+    {
+        void operator()(ZSTD_DStream* ctx) const { ZSTD_freeDStream(ctx); }
+    };
+
+    std::ifstream in_;
+    std::unique_ptr<ZSTD_DStream, Freer> ctx_;
+    std::vector<std::byte> in_buf_;
+    ZSTD_inBuffer input_{nullptr, 0, 0};
+    bool in_eof_{false};
+};
+#endif
+} // namespace
+
+bool Itch_File::is_compressed(const std::filesystem::path& path)
+{
+    return path.extension() == ".gz" || path.extension() == ".zst";
+}
+
+std::int64_t Itch_File::mtime(const std::filesystem::path& path)
+{
+    return static_cast<std::int64_t>(std::filesystem::last_write_time(path).time_since_epoch().count());
+}
+
+Itch_File::Itch_File(const std::filesystem::path& path,
+                     const std::filesystem::path& spill_dir,
+                     std::size_t prefetch_window,
+                     std::size_t prefetch_retain,
+                     Page_Backing backing)
+{
+    if (!is_compressed(path) && backing != Page_Backing::normal && prefetch_window == 0 &&
+        std::filesystem::file_size(path) > 0)
+    {
+        max_len_ = std::filesystem::file_size(path);
+        copy_.emplace(max_len_, backing);
+        std::ifstream in{path, std::ios::binary};
+        if (!in.read(reinterpret_cast<char*>(copy_->data()), static_cast<std::streamsize>(max_len_)))
+        {
+            throw std::runtime_error(std::format("failed reading {}", path.string()));
+        }
+        base_ = copy_->data();
+        state_.store(max_len_ | complete_bit, std::memory_order_relaxed);
+        return;
+    }
+
+    if (!is_compressed(path))
+    {
+        map_.emplace(path, PROT_READ, MAP_PRIVATE | (prefetch_window == 0 ? MAP_POPULATE : 0), 0);
+        base_ = map_->at(0);
+        max_len_ = map_->len();
+        state_.store(max_len_ | complete_bit, std::memory_order_relaxed);
+
+        if (prefetch_window > 0)
+        {
+            const int fd{open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+            if (fd < 0)
+            {
+                throw std::system_error(errno, std::system_category(), path.string());
+            }
+            fd_.emplace(fd);
+            madvise(base_, max_len_, MADV_SEQUENTIAL);
+            prefetcher_ = std::jthread{[this, prefetch_window, prefetch_retain](const std::stop_token& stop) {
+                prefetch(stop, prefetch_window, prefetch_retain);
+            }};
+        }
+        return;
+    }
+
+    Read_Fn read;
+    if (path.extension() == ".gz")
+    {
+        read = [reader{std::make_shared<Gzip_Reader>(path)}](std::byte* out, std::size_t len) {
+            return reader->read(out, len);
+        };
+    }
+    else
+    {
+#ifdef WITH_ZSTD
+        read = [reader{std::make_shared<Zstd_Reader>(path)}](std::byte* out, std::size_t len) {
+            return reader->read(out, len);
+        };
+#else
+        throw std::invalid_argument(std::format("{}: built without zstd support (-DWITH_ZSTD=On)", path.string()));
+#endif
+    }
+
+    // unlinked so nothing is left behind, the page cache keeps recent data hot and the
+    // kernel writes back the rest
+    const int spill_fd{open(spill_dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600)};
+    if (spill_fd < 0)
+    {
+        throw std::system_error(errno, std::system_category(), std::format("spill file in {}", spill_dir.string()));
+    }
+    fd_.emplace(spill_fd);
+
+    max_len_ = config::stream_reserve_len;
+    void* reserved{mmap(nullptr, max_len_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)};
+    if (reserved == MAP_FAILED)
+    {
+        throw std::system_error(errno, std::system_category(), "reserving decompressed file range");
+    }
+    base_ = static_cast<std::byte*>(reserved);
+
+    decompressor_ = std::jthread{[this, read{std::move(read)}](const std::stop_token& stop) { decompress(stop, read); }};
+}
+
+Itch_File::~Itch_File()
+{
+    for (auto* thread : {&decompressor_, &prefetcher_})
+    {
+        if (thread->joinable())
+        {
+            thread->request_stop();
+            thread->join();
+        }
+    }
+    if (streaming())
+    {
+        munmap(base_, max_len_);
+    }
+}
+
+void Itch_File::check() const
+{
+    if (complete() && error_)
+    {
+        std::rethrow_exception(error_);
+    }
+}
+
+std::size_t Itch_File::wait_for(std::size_t end) const
+{
+    auto state{state_.load(std::memory_order_acquire)};
+    while ((state & len_mask) < end && (state & complete_bit) == 0)
+    {
+        state_.wait(state, std::memory_order_acquire);
+        state = state_.load(std::memory_order_acquire);
+    }
+    return state & len_mask;
+}
+
+void Itch_File::decompress(const std::stop_token& stop, const Read_Fn& read)
+{
+    std::size_t written{0};
+    try
+    {
+        while (!stop.stop_requested())
+        {
+            if (written == mapped_)
+            {
+                map_chunk();
+            }
+            const auto n{read(base_ + written, std::min(config::stream_read_size, mapped_ - written))};
+            if (n == 0)
+            {
+                break;
+            }
+            written += n;
+            state_.store(written, std::memory_order_release);
+            state_.notify_all();
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::println(std::cerr, "decompression failed after {} bytes: {}", written, e.what());
+        error_ = std::current_exception();
+    }
+    state_.store(written | complete_bit, std::memory_order_release);
+    state_.notify_all();
+}
+
+void Itch_File::map_chunk()
+{
+    if (mapped_ + config::stream_map_chunk > max_len_)
+    {
+        throw std::runtime_error("decompressed file larger than config::stream_reserve_len");
+    }
+    if (ftruncate(fd_->fd(), static_cast<off_t>(mapped_ + config::stream_map_chunk)) < 0)
+    {
+        throw std::system_error(errno, std::system_category(), "growing spill file");
+    }
+    // replaces part of the reservation, readers never touch past len() so nothing they see moves
+    if (mmap(base_ + mapped_,
+             config::stream_map_chunk,
+             PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED,
+             fd_->fd(),
+             static_cast<off_t>(mapped_)) == MAP_FAILED)
+    {
+        throw std::system_error(errno, std::system_category(), "mapping spill file");
+    }
+    mapped_ += config::stream_map_chunk;
+}
+
+std::size_t Itch_File::add_reader()
+{
+    const auto reader{num_readers_.load(std::memory_order_relaxed)};
+    if (reader == read_pos_.size())
+    {
+        throw std::invalid_argument(std::format("more than {} readers of one itch file", read_pos_.size()));
+    }
+    num_readers_.store(reader + 1, std::memory_order_release);
+    return reader;
+}
+
+void Itch_File::prefetch(const std::stop_token& stop, std::size_t window, std::size_t retain)
+{
+    const auto page_size{static_cast<std::size_t>(sysconf(_SC_PAGESIZE))};
+    std::size_t prefetched{0};
+    std::size_t dropped{0};
+    while (!stop.stop_requested())
+    {
+        // channels parse the file at their own pace
+        std::size_t min_pos{0};
+        std::size_t max_pos{0};
+        const auto num_readers{num_readers_.load(std::memory_order_acquire)};
+        for (std::size_t i = 0; i < num_readers; ++i)
+        {
+            const auto pos{read_pos_[i].pos.load(std::memory_order_relaxed)};
+            min_pos = i == 0 ? pos : std::min(min_pos, pos);
+            max_pos = std::max(max_pos, pos);
+        }
+
+        // WILLNEED starts async readahead, the downstream still takes minor faults mapping the pages in
+        const auto begin{std::max(prefetched, max_pos) / page_size * page_size};
+        if (const auto end{std::min(max_pos + window, max_len_)}; end > begin)
+        {
+            madvise(base_ + begin, end - begin, MADV_WILLNEED);
+            prefetched = end;
+        }
+
+        // retransmissions behind the horizon still work, they fault the pages back in from disk
+        if (retain > 0 && min_pos > retain)
+        {
+            if (const auto end{(min_pos - retain) / page_size * page_size}; end > dropped)
+            {
+                madvise(base_ + dropped, end - dropped, MADV_DONTNEED);
+                posix_fadvise(fd_->fd(), static_cast<off_t>(dropped), static_cast<off_t>(end - dropped), POSIX_FADV_DONTNEED);
+                dropped = end;
+            }
+        }
+
+        if (prefetched >= max_len_ && retain == 0)
+        {
+            return;
+        }
+        std::this_thread::sleep_for(config::prefetch_interval);
+    }
+}
@@ -0,0 +1,118 @@
+#ifndef ITCH_FILE_H
+#define ITCH_FILE_H
+
+#include "config.h"
+#include "memory_region.h"
+
+#include "jamutils/M_Map.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <thread>
+
+// the replayed ITCH file. Plain files are mapped whole, populated up front or, given a
+// prefetch_window, lazily with a background thread reading the window ahead of the downstream
+// and dropping pages more than prefetch_retain behind it (0 keeps everything). Populated up
+// front they can instead be copied onto huge pages, retransmissions read it at random.
+// .gz (and .zst when built WITH_ZSTD) files are decompressed by a background thread into an
+// unlinked spill file mapped into one reserved range, so positions are stable while it grows
+// and retransmissions keep random access to everything decompressed so far. Readers must
+// ensure() bytes past what they have already seen before touching them
+class Itch_File
+{
+  public:
+    // spill_dir is only used for compressed files, prefetch_* and backing only for plain files
+    explicit Itch_File(const std::filesystem::path& path,
+                       const std::filesystem::path& spill_dir = std::filesystem::temp_directory_path(),
+                       std::size_t prefetch_window = 0,
+                       std::size_t prefetch_retain = 0,
+                       Page_Backing backing = Page_Backing::normal);
+    ~Itch_File();
+
+    Itch_File(const Itch_File&) = delete;
+    Itch_File& operator=(const Itch_File&) = delete;
+
+    static bool is_compressed(const std::filesystem::path& path);
+
+    // what the sidecars built from a file are checked against, with its length
+    static std::int64_t mtime(const std::filesystem::path& path);
+
+    bool streaming() const { return !map_ && !copy_; }
+
+    Page_Backing backing() const { return copy_ ? copy_->backing() : Page_Backing::normal; }
+
+    std::byte* at(std::size_t pos) const { return base_ + pos; }
+
+    // bytes available now
+    std::size_t len() const { return state_.load(std::memory_order_acquire) & len_mask; }
+
+    bool complete() const { return (state_.load(std::memory_order_acquire) & complete_bit) != 0; }
+
+    // final length once complete, the reserved range while streaming
+    std::size_t max_len() const { return max_len_; }
+
+    // blocks until at least end bytes are available or there are no more, returns len()
+    std::size_t ensure(std::size_t end) const
+    {
+        const auto state{state_.load(std::memory_order_acquire)};
+        if ((state & len_mask) >= end || (state & complete_bit) != 0)
+        {
+            return state & len_mask;
+        }
+        return wait_for(end);
+    }
+
+    // registers a reader which reports its progress with advance(), before it starts reading.
+    // The prefetcher reads ahead of the furthest reader and only drops pages behind the slowest
+    std::size_t add_reader();
+
+    // where reader has read up to, each reader's position has a single writer
+    void advance(std::size_t reader, std::size_t pos)
+    {
+        auto& read_pos{read_pos_[reader].pos};
+        if (pos >= read_pos.load(std::memory_order_relaxed) + config::prefetch_step)
+        {
+            read_pos.store(pos, std::memory_order_relaxed);
+        }
+    }
+
+    // rethrows a decompression error, once complete
+    void check() const;
+
+  private:
+    using Read_Fn = std::function<std::size_t(std::byte* out, std::size_t len)>;
+
+    static constexpr std::uint64_t complete_bit{std::uint64_t{1} << 63U};
+    static constexpr std::uint64_t len_mask{complete_bit - 1};
+
+    std::size_t wait_for(std::size_t end) const;
+    void decompress(const std::stop_token& stop, const Read_Fn& read);
+    void map_chunk();
+    void prefetch(const std::stop_token& stop, std::size_t window, std::size_t retain);
+
+    std::optional<jam_utils::M_Map> map_;
+    std::optional<Memory_Region> copy_;
+    std::optional<jam_utils::FD> fd_; // spill file when streaming, the file itself when prefetching
+    std::byte* base_{};
+    std::size_t max_len_{};
+    std::size_t mapped_{};
+    // len | complete_bit, one word so a waiter is always woken by the final store
+    std::atomic<std::uint64_t> state_{};
+    std::exception_ptr error_;
+    struct alignas(64) Read_Pos
+    {
+        std::atomic<std::size_t> pos{0};
+    };
+    std::array<Read_Pos, config::max_file_readers> read_pos_{};
+    std::atomic<std::size_t> num_readers_{0};
+    std::jthread decompressor_;
+    std::jthread prefetcher_;
+};
+
+#endif
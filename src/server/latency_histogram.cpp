@@ -0,0 +1,79 @@
+#include "latency_histogram.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+std::size_t Latency_Histogram::bucket_for(std::uint64_t value)
+{
+    if (value < sub_buckets)
+    {
+        return value;
+    }
+    const auto shift{static_cast<unsigned>(std::bit_width(value)) - 1 - sub_bucket_bits};
+    return ((std::size_t{shift} + 1) << sub_bucket_bits) + ((value >> shift) - sub_buckets);
+}
+
+std::uint64_t Latency_Histogram::bucket_value(std::size_t bucket)
+{
+    if (bucket < sub_buckets)
+    {
+        return bucket;
+    }
+    const auto shift{(bucket >> sub_bucket_bits) - 1};
+    return (sub_buckets + (bucket & (sub_buckets - 1))) << shift;
+}
+
+namespace
+{
+void add_relaxed(std::atomic<std::uint64_t>& value, std::uint64_t n)
+{
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+} // namespace
+
+void Latency_Histogram::record(std::chrono::nanoseconds value)
+{
+    const auto ns{static_cast<std::uint64_t>(std::max<std::int64_t>(value.count(), 0))};
+    add_relaxed(buckets_[bucket_for(ns)], 1);
+    add_relaxed(count_, 1);
+    if (ns > max_.load(std::memory_order_relaxed))
+    {
+        max_.store(ns, std::memory_order_relaxed);
+    }
+}
+
+void Latency_Histogram::merge(const Latency_Histogram& other)
+{
+    for (std::size_t bucket = 0; bucket < buckets_.size(); ++bucket)
+    {
+        add_relaxed(buckets_[bucket], other.buckets_[bucket].load(std::memory_order_relaxed));
+    }
+    add_relaxed(count_, other.count());
+    if (other.max() > max())
+    {
+        max_.store(static_cast<std::uint64_t>(other.max().count()), std::memory_order_relaxed);
+    }
+}
+
+std::chrono::nanoseconds Latency_Histogram::percentile(double p) const
+{
+    const auto total{count()};
+    if (total == 0)
+    {
+        return {};
+    }
+    const auto rank{std::max<std::uint64_t>(
+        1, static_cast<std::uint64_t>(std::ceil(static_cast<double>(total) * std::clamp(p, 0.0, 100.0) / 100.0)))};
+
+    std::uint64_t seen{0};
+    for (std::size_t bucket = 0; bucket < buckets_.size(); ++bucket)
+    {
+        seen += buckets_[bucket].load(std::memory_order_relaxed);
+        if (seen >= rank)
+        {
+            return std::min(std::chrono::nanoseconds{static_cast<std::int64_t>(bucket_value(bucket))}, max());
+        }
+    }
+    return max();
+}
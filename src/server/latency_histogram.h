@@ -0,0 +1,41 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// log linear histogram of nanosecond durations: exact below 32ns then 32 buckets per
+// power of 2, so any percentile is within ~3% of the true value in a fixed 15 KB.
+// Single writer: record() is plain relaxed loads and stores so it costs no more than a
+// non atomic histogram, while other threads can read it at any time
+class Latency_Histogram
+{
+  public:
+    void record(std::chrono::nanoseconds value);
+
+    // adds other's counts into this one, same single writer rule as record()
+    void merge(const Latency_Histogram& other);
+
+    std::uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    std::chrono::nanoseconds max() const { return std::chrono::nanoseconds{max_.load(std::memory_order_relaxed)}; }
+
+    // lower bound of the bucket holding the p'th percentile, p in [0, 100]
+    std::chrono::nanoseconds percentile(double p) const;
+
+  private:
+    static constexpr unsigned sub_bucket_bits{5};
+    static constexpr std::size_t sub_buckets{std::size_t{1} << sub_bucket_bits};
+    static constexpr std::size_t num_buckets{(64 - sub_bucket_bits + 1) * sub_buckets};
+
+    static std::size_t bucket_for(std::uint64_t value);
+    static std::uint64_t bucket_value(std::size_t bucket);
+
+    std::array<std::atomic<std::uint64_t>, num_buckets> buckets_{};
+    std::atomic<std::uint64_t> count_{0};
+    std::atomic<std::uint64_t> max_{0};
+};
+
+#endif
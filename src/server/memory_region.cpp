@@ -0,0 +1,84 @@
+#include "memory_region.h"
+
+#include <linux/mman.h>
+#include <sys/mman.h>
+#include <cerrno>
+#include <system_error>
+
+namespace
+{
+std::size_t page_size(Page_Backing backing)
+{
+    switch (backing)
+    {
+    case Page_Backing::huge_2mb:
+        return std::size_t{1} << 21U;
+    case Page_Backing::huge_1gb:
+        return std::size_t{1} << 30U;
+    default:
+        return std::size_t{1} << 12U;
+    }
+}
+} // namespace
+
+const char* to_string(Page_Backing backing)
+{
+    switch (backing)
+    {
+    case Page_Backing::transparent:
+        return "thp";
+    case Page_Backing::huge_2mb:
+        return "2m";
+    case Page_Backing::huge_1gb:
+        return "1g";
+    default:
+        return "off";
+    }
+}
+
+Memory_Region::Memory_Region(std::size_t len, Page_Backing backing, bool noreserve)
+    : backing_{backing}
+{
+    if (backing_ == Page_Backing::huge_2mb || backing_ == Page_Backing::huge_1gb)
+    {
+        // hugetlb lengths must be a whole number of pages
+        const auto huge_page_size{page_size(backing_)};
+        len_ = (len + huge_page_size - 1) / huge_page_size * huge_page_size;
+        void* data{mmap(nullptr,
+                        len_,
+                        PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+                            (backing_ == Page_Backing::huge_2mb ? MAP_HUGE_2MB : MAP_HUGE_1GB),
+                        -1,
+                        0)};
+        if (data != MAP_FAILED)
+        {
+            data_ = static_cast<std::byte*>(data);
+            return;
+        }
+        backing_ = Page_Backing::transparent;
+    }
+
+    len_ = len;
+    void* data{mmap(nullptr,
+                    len_,
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | (noreserve ? MAP_NORESERVE : 0),
+                    -1,
+                    0)};
+    if (data == MAP_FAILED)
+    {
+        throw std::system_error(errno, std::system_category(), "mmap");
+    }
+    data_ = static_cast<std::byte*>(data);
+
+    if (backing_ == Page_Backing::transparent && madvise(data_, len_, MADV_HUGEPAGE) < 0)
+    {
+        backing_ = Page_Backing::normal;
+    }
+}
+
+Memory_Region::~Memory_Region()
+{
+    munmap(data_, len_);
+}
@@ -0,0 +1,47 @@
+#ifndef MEMORY_REGION_H
+#define MEMORY_REGION_H
+
+#include <cstddef>
+#include <map>
+#include <string>
+
+enum class Page_Backing
+{
+    normal,      // 4 KB pages
+    transparent, // madvise(MADV_HUGEPAGE), the kernel promotes to 2 MB pages when it can
+    huge_2mb,    // MAP_HUGETLB from the reserved pool (vm.nr_hugepages)
+    huge_1gb
+};
+
+// for CLI11
+const std::map<std::string, Page_Backing> page_backing_map{{"off", Page_Backing::normal},
+                                                           {"thp", Page_Backing::transparent},
+                                                           {"2m", Page_Backing::huge_2mb},
+                                                           {"1g", Page_Backing::huge_1gb}};
+
+const char* to_string(Page_Backing backing);
+
+// anonymous read/write mapping. Huge pages fall back to transparent then normal pages when
+// none are reserved or THP is disabled, backing() is what was actually used. noreserve skips
+// overcommit accounting for sparse regions, hugetlb pages are always reserved up front since
+// a noreserve hugetlb fault with the pool empty is a SIGBUS
+class Memory_Region
+{
+  public:
+    Memory_Region(std::size_t len, Page_Backing backing, bool noreserve = false);
+    ~Memory_Region();
+
+    Memory_Region(const Memory_Region&) = delete;
+    Memory_Region& operator=(const Memory_Region&) = delete;
+
+    std::byte* data() const { return data_; }
+    std::size_t len() const { return len_; }
+    Page_Backing backing() const { return backing_; }
+
+  private:
+    std::byte* data_{};
+    std::size_t len_{};
+    Page_Backing backing_;
+};
+
+#endif
@@ -1,12 +1,56 @@
 #include "config.h"
+#include "itch.h"
 #include "message_buffer.h"
 
+#include <algorithm>
+#include <stdexcept>
+
+Message_Buffer::Message_Buffer(Itch_File& itch_file,
+                               const Message_Filter& filter,
+                               const Session_Index* session_index,
+                               Page_Backing backing,
+                               const Packet_File* packet_file)
+    : itch_file_{itch_file},
+      filter_{filter},
+      session_index_{session_index},
+      packet_file_{packet_file},
+      checkpoint_interval_{filter.accepts_all() ? config::msg_checkpoint_interval : 1},
+      // a packet file serves every lookup, there is nothing to store
+      capacity_{packet_file != nullptr ? 0 : (itch_file.max_len() / itch::min_msg_total_len / checkpoint_interval_) + 2},
+      chunk_len_{itch_file.streaming() ? config::msg_checkpoint_chunk / sizeof(std::size_t) : std::max<std::size_t>(capacity_, 1)},
+      chunks_((capacity_ + chunk_len_ - 1) / chunk_len_),
+      backing_{backing}
+{
+    // mapped up front so backing() reports what the rest will get
+    if (!chunks_.empty())
+    {
+        chunks_.front() = std::make_unique<Memory_Region>(chunk_len_ * sizeof(std::size_t), backing_, true);
+        backing_ = chunks_.front()->backing();
+    }
+}
+
 void Message_Buffer::push(std::uint64_t seq, std::size_t pos)
 {
-    const auto idx{seq % config::msg_buffer_size};
+    if (first_seq_ == 0)
+    {
+        first_seq_ = seq;
+        first_pos_ = pos;
+    }
 
-    buffer_[idx].seq_num = seq;
-    buffer_[idx].file_pos = pos;
+    if ((seq - 1) % checkpoint_interval_ == 0)
+    {
+        const auto idx{(seq - 1) / checkpoint_interval_};
+        if (idx >= capacity_)
+        {
+            throw std::runtime_error("message buffer capacity exceeded");
+        }
+        if (auto& chunk{chunks_[idx / chunk_len_]}; !chunk)
+        {
+            // readers only reach it through a sequence number published after it
+            chunk = std::make_unique<Memory_Region>(chunk_len_ * sizeof(std::size_t), backing_, true);
+        }
+        checkpoint(idx) = pos;
+    }
 
     write_seq_.store(seq, std::memory_order_release);
 }
@@ -15,17 +59,50 @@ std::optional<std::size_t> Message_Buffer::get_file_pos(std::uint64_t seq)
 {
     const auto current_seq{write_seq_.load(std::memory_order_acquire)};
 
-    if (seq + config::msg_buffer_size <= current_seq || seq > current_seq)
+    if (seq == 0 || seq > current_seq)
     {
         return std::nullopt;
     }
 
-    const auto& entry{buffer_[seq % config::msg_buffer_size]};
+    if (packet_file_ != nullptr)
+    {
+        const auto* packet{packet_file_->find(seq)};
+        if (packet == nullptr)
+        {
+            return std::nullopt;
+        }
+        return walk(packet->file_pos, seq - packet->seq_num);
+    }
 
-    if (entry.seq_num != seq)
+    if (seq < first_seq_)
     {
-        return std::nullopt;
+        if (session_index_ == nullptr)
+        {
+            return std::nullopt;
+        }
+        const auto checkpoint{session_index_->checkpoint_before(seq)};
+        return walk(checkpoint.file_pos, seq - checkpoint.seq_num);
+    }
+
+    const auto idx{(seq - 1) / checkpoint_interval_};
+    const auto checkpoint_seq{(idx * checkpoint_interval_) + 1};
+
+    if (checkpoint_seq < first_seq_)
+    {
+        return walk(first_pos_, seq - first_seq_);
     }
+    return walk(checkpoint(idx), seq - checkpoint_seq);
+}
 
-    return entry.file_pos;
+std::size_t Message_Buffer::walk(std::size_t pos, std::uint64_t num_msgs) const
+{
+    // the downstream validated these messages before pushing them
+    for (std::uint64_t i = 0; i < num_msgs; ++i)
+    {
+        do
+        {
+            pos += itch::len_prefix_size + itch::extract_len(itch_file_.at(pos));
+        } while (!filter_.accept(itch_file_.at(pos)));
+    }
+    return pos;
 }
@@ -2,28 +2,72 @@
 #define MESSAGE_BUFFER_H
 
 #include "config.h"
+#include "itch_file.h"
+#include "memory_region.h"
+#include "message_filter.h"
+#include "packet_file.h"
+#include "session_index.h"
 
-#include <array>
 #include <cstdint>
 #include <cstddef>
 #include <atomic>
+#include <memory>
 #include <optional>
+#include <vector>
 
+// sequence number -> file position for the whole session. Only every
+// config::msg_checkpoint_interval'th position is stored and lookups walk forward from it
+// by length prefix, so memory is a fraction of a byte per message and lookups are bounded.
+// On a filtered channel the walk would also cross every other channel's messages, so
+// there every position is stored instead
 class Message_Buffer
 {
   public:
+    // session_index, if given, serves lookups for messages before the first push (i.e. skipped by a seek),
+    // its sequence numbers are for the whole file so it must not be given with a filter
+    // lookups are random so the checkpoints can be put on huge pages to save TLB misses.
+    // packet_file, if given, serves every lookup instead, nothing is mapped and the downstream only publishes
+    explicit Message_Buffer(Itch_File& itch_file,
+                            const Message_Filter& filter,
+                            const Session_Index* session_index = nullptr,
+                            Page_Backing backing = Page_Backing::normal,
+                            const Packet_File* packet_file = nullptr);
+
+    Page_Backing backing() const { return backing_; }
+
     void push(std::uint64_t seq, std::size_t pos);
 
+    // messages up to seq are sent, with a packet file to look them up in
+    void publish(std::uint64_t seq) { write_seq_.store(seq, std::memory_order_release); }
+    std::uint64_t last_seq() const { return write_seq_.load(std::memory_order_acquire); }
+    const Packet_File* packet_file() const { return packet_file_; }
+
     std::optional<std::size_t> get_file_pos(uint64_t seq);
 
   private:
-    struct Message
+    std::size_t walk(std::size_t pos, std::uint64_t num_msgs) const;
+    std::size_t& checkpoint(std::size_t idx) const
     {
-        std::uint64_t seq_num;
-        std::size_t file_pos;
-    };
+        return reinterpret_cast<std::size_t*>(chunks_[idx / chunk_len_]->data())[idx % chunk_len_];
+    }
+
+    Itch_File& itch_file_;
+    const Message_Filter& filter_;
+    const Session_Index* session_index_;
+    const Packet_File* packet_file_;
+    const std::size_t checkpoint_interval_;
+
+    // sized for the most messages the file could hold, in chunks mapped as the session reaches
+    // them. A streamed file is only bounded by its reservation so it grows config::msg_checkpoint_chunk
+    // at a time, otherwise one chunk covers the file and its pages are only touched as it fills
+    std::size_t capacity_;
+    std::size_t chunk_len_; // checkpoints
+    std::vector<std::unique_ptr<Memory_Region>> chunks_;
+    Page_Backing backing_;
 
-    std::array<Message, config::msg_buffer_size> buffer_{};
+    // first push may not be on a checkpoint boundary after a seek
+    std::uint64_t first_seq_{};
+    std::size_t first_pos_{};
     std::atomic<std::uint64_t> write_seq_{0};
 };
 
@@ -0,0 +1,60 @@
+#include "message_filter.h"
+
+#include <format>
+#include <stdexcept>
+
+std::vector<Message_Filter> Message_Filter::for_channels(std::size_t num_channels,
+                                                         const std::vector<std::size_t>& channel_by_locate)
+{
+    std::vector<Message_Filter> filters(num_channels);
+    for (auto& filter : filters)
+    {
+        filter.accept_all_ = num_channels == 1;
+        filter.locates_.set(0);
+    }
+    for (std::size_t locate = 1; locate < channel_by_locate.size() && locate <= itch::max_stock_locate; ++locate)
+    {
+        filters[channel_by_locate[locate] % num_channels].locates_.set(locate);
+    }
+    return filters;
+}
+
+void Message_Filter::narrow()
+{
+    if (accept_all_)
+    {
+        accept_all_ = false;
+        locates_.set();
+    }
+}
+
+void Message_Filter::allow_locates(const std::vector<std::uint16_t>& locates)
+{
+    narrow();
+    std::bitset<itch::max_stock_locate + 1> allowed;
+    allowed.set(0);
+    for (const auto locate : locates)
+    {
+        allowed.set(locate);
+    }
+    locates_ &= allowed;
+}
+
+void Message_Filter::allow_types(std::string_view types)
+{
+    std::array<bool, 256> allowed{};
+    for (const auto type : types)
+    {
+        const auto index{static_cast<std::uint8_t>(type)};
+        if (itch::msg_len_by_type[index] == 0)
+        {
+            throw std::invalid_argument(std::format("unknown ITCH message type '{}'", type));
+        }
+        allowed[index] = true;
+    }
+    narrow();
+    for (std::size_t i = 0; i < types_.size(); ++i)
+    {
+        types_[i] = types_[i] && allowed[i];
+    }
+}
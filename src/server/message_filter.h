@@ -0,0 +1,54 @@
+#ifndef MESSAGE_FILTER_H
+#define MESSAGE_FILTER_H
+
+#include "itch.h"
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// which ITCH messages a downstream channel carries. Downstream packetization,
+// Message_Buffer lookups and retransmission responses all skip the same messages
+// so sequence numbers stay dense within the channel
+class Message_Filter
+{
+  public:
+    // accepts every message
+    Message_Filter() = default;
+
+    // one filter per channel from the channel of every stock locate,
+    // messages with locate 0 (system wide) are carried on every channel
+    static std::vector<Message_Filter> for_channels(std::size_t num_channels,
+                                                    const std::vector<std::size_t>& channel_by_locate);
+
+    // narrow what the filter carries to these stock locates, system wide messages are kept
+    void allow_locates(const std::vector<std::uint16_t>& locates);
+
+    // narrow what the filter carries to these message types, throws on a type ITCH doesn't have
+    void allow_types(std::string_view types);
+
+    bool accepts_all() const { return accept_all_; }
+
+    // two table lookups and no branch between them
+    bool accept(const std::byte* msg_start) const
+    {
+        return accept_all_ || (types_[static_cast<std::uint8_t>(itch::extract_msg_type(msg_start))] &
+                               locates_[itch::extract_stock_locate(msg_start)]);
+    }
+
+  private:
+    void narrow();
+
+    bool accept_all_{true};
+    std::bitset<itch::max_stock_locate + 1> locates_;
+    std::array<bool, 256> types_{[] {
+        std::array<bool, 256> types{};
+        types.fill(true);
+        return types;
+    }()};
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "metrics.h"
+
+#include <chrono>
+#include <format>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <utility>
+
+namespace
+{
+std::string format_labels(std::string_view session, std::size_t channel)
+{
+    return std::format("session=\"{}\",channel=\"{}\"", session, channel);
+}
+
+void append_counter(std::string& out, std::string_view name, std::string_view labels, std::int64_t value)
+{
+    std::format_to(std::back_inserter(out), "{}{{{}}} {}\n", name, labels, value);
+}
+
+void append_counter(std::string& out, std::string_view name, std::string_view labels, std::uint64_t value)
+{
+    std::format_to(std::back_inserter(out), "{}{{{}}} {}\n", name, labels, value);
+}
+
+void append_histogram(std::string& out, std::string_view name, std::string_view labels, const Latency_Histogram& histogram)
+{
+    for (const double quantile : {50.0, 99.0, 99.9})
+    {
+        std::format_to(std::back_inserter(out),
+                       "{}_ns{{{},quantile=\"{}\"}} {}\n",
+                       name,
+                       labels,
+                       quantile / 100.0,
+                       histogram.percentile(quantile).count());
+    }
+    std::format_to(std::back_inserter(out), "{}_ns_max{{{}}} {}\n", name, labels, histogram.max().count());
+    std::format_to(std::back_inserter(out), "{}_ns_count{{{}}} {}\n", name, labels, histogram.count());
+}
+} // namespace
+
+Downstream_Metrics& Metrics::add_downstream(std::string_view session, std::size_t channel)
+{
+    const std::scoped_lock lock{mutex_};
+    return downstream_.emplace_back(session, channel, started_at_);
+}
+
+Retransmission_Metrics& Metrics::add_retransmission(std::string_view session, std::size_t channel)
+{
+    const std::scoped_lock lock{mutex_};
+    return retransmission_.emplace_back(session, channel);
+}
+
+Soup_Bin_Metrics& Metrics::add_soup_bin(std::string_view session, std::size_t channel)
+{
+    const std::scoped_lock lock{mutex_};
+    return soup_bin_.emplace_back(session, channel);
+}
+
+std::string Metrics::snapshot() const
+{
+    const std::scoped_lock lock{mutex_};
+
+    std::string out{std::format("# itch-mold-replay {}\n", std::chrono::system_clock::now())};
+
+    for (const auto& downstream : downstream_)
+    {
+        const auto channel_labels{format_labels(downstream.session, downstream.channel)};
+        append_counter(out, "downstream_packets_sent", channel_labels, downstream.packets_sent.load());
+        append_counter(out, "downstream_msgs_sent", channel_labels, downstream.msgs_sent.load());
+        append_counter(out, "downstream_bytes_sent", channel_labels, downstream.bytes_sent.load());
+        append_counter(out, "downstream_send_errors", channel_labels, downstream.send_errors.load());
+        append_histogram(out, "downstream_send_latency", channel_labels, downstream.send_latency);
+        append_histogram(out, "downstream_pacing_lateness", channel_labels, downstream.pacing_lateness);
+        append_counter(out, "downstream_replay_timestamp_ns", channel_labels, downstream.replay_timestamp.load());
+        append_counter(out, "downstream_replay_lag_ns", channel_labels, downstream.replay_lag.load());
+        append_counter(out, "downstream_time_to_first_packet_ns", channel_labels, downstream.time_to_first_packet.load());
+        append_counter(out, "downstream_rate_target", channel_labels, downstream.rate_target.load());
+        append_counter(out, "downstream_rate_achieved", channel_labels, downstream.rate_achieved.load());
+        append_counter(out, "downstream_pipeline_occupancy", channel_labels, downstream.pipeline_occupancy.load());
+        append_counter(out, "downstream_pipeline_starved", channel_labels, downstream.pipeline_starved.load());
+    }
+
+    // histograms are 15 KB each so keep the per channel sums off the stack
+    struct Channel_Sum
+    {
+        std::uint64_t requests{};
+        std::uint64_t invalid_requests{};
+        std::uint64_t cache_hits{};
+        std::uint64_t cache_misses{};
+        std::uint64_t buffer_hits{};
+        std::uint64_t buffer_misses{};
+        std::uint64_t responses_sent{};
+        std::uint64_t bytes_sent{};
+        std::uint64_t dropped{};
+        std::uint64_t throttled{};
+        std::uint64_t coalesced{};
+        std::unique_ptr<Latency_Histogram> response_latency{std::make_unique<Latency_Histogram>()};
+    };
+    std::map<std::pair<std::string_view, std::size_t>, Channel_Sum> channels;
+    for (const auto& worker : retransmission_)
+    {
+        auto& sum{channels[{worker.session, worker.channel}]};
+        sum.requests += worker.requests.load();
+        sum.invalid_requests += worker.invalid_requests.load();
+        sum.cache_hits += worker.cache_hits.load();
+        sum.cache_misses += worker.cache_misses.load();
+        sum.buffer_hits += worker.buffer_hits.load();
+        sum.buffer_misses += worker.buffer_misses.load();
+        sum.responses_sent += worker.responses_sent.load();
+        sum.bytes_sent += worker.bytes_sent.load();
+        sum.dropped += worker.dropped.load();
+        sum.throttled += worker.throttled.load();
+        sum.coalesced += worker.coalesced.load();
+        sum.response_latency->merge(worker.response_latency);
+    }
+    for (const auto& [key, sum] : channels)
+    {
+        const auto channel_labels{format_labels(key.first, key.second)};
+        append_counter(out, "retrans_requests", channel_labels, sum.requests);
+        append_counter(out, "retrans_invalid_requests", channel_labels, sum.invalid_requests);
+        append_counter(out, "retrans_cache_hits", channel_labels, sum.cache_hits);
+        append_counter(out, "retrans_cache_misses", channel_labels, sum.cache_misses);
+        append_counter(out, "retrans_buffer_hits", channel_labels, sum.buffer_hits);
+        append_counter(out, "retrans_buffer_misses", channel_labels, sum.buffer_misses);
+        append_counter(out, "retrans_responses_sent", channel_labels, sum.responses_sent);
+        append_counter(out, "retrans_bytes_sent", channel_labels, sum.bytes_sent);
+        append_counter(out, "retrans_dropped", channel_labels, sum.dropped);
+        append_counter(out, "retrans_throttled", channel_labels, sum.throttled);
+        append_counter(out, "retrans_coalesced", channel_labels, sum.coalesced);
+        append_histogram(out, "retrans_response_latency", channel_labels, *sum.response_latency);
+    }
+
+    for (const auto& soup_bin : soup_bin_)
+    {
+        const auto channel_labels{format_labels(soup_bin.session, soup_bin.channel)};
+        append_counter(out, "soup_bin_clients", channel_labels, soup_bin.clients.load());
+        append_counter(out, "soup_bin_logins", channel_labels, soup_bin.logins.load());
+        append_counter(out, "soup_bin_rejected_logins", channel_labels, soup_bin.rejected_logins.load());
+        append_counter(out, "soup_bin_timeouts", channel_labels, soup_bin.timeouts.load());
+        append_counter(out, "soup_bin_msgs_sent", channel_labels, soup_bin.msgs_sent.load());
+        append_counter(out, "soup_bin_bytes_sent", channel_labels, soup_bin.bytes_sent.load());
+        append_counter(out, "soup_bin_stalls", channel_labels, soup_bin.stalls.load());
+        append_counter(out, "soup_bin_max_client_lag", channel_labels, soup_bin.max_client_lag.load());
+    }
+    return out;
+}
@@ -0,0 +1,131 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "latency_histogram.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+// single writer counter, a relaxed load and store rather than a locked add so it costs
+// the same as a plain increment on the hot path
+class Counter
+{
+  public:
+    void add(std::uint64_t n = 1) { value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    std::uint64_t load() const { return value_.load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<std::uint64_t> value_{0};
+};
+
+class Gauge
+{
+  public:
+    void set(std::int64_t value) { value_.store(value, std::memory_order_relaxed); }
+    std::int64_t load() const { return value_.load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<std::int64_t> value_{0};
+};
+
+// written only by the channel's downstream thread
+struct alignas(64) Downstream_Metrics
+{
+    std::string session;
+    std::size_t channel;
+    std::chrono::steady_clock::time_point started_at; // when the process started, for time_to_first_packet
+    Counter packets_sent;
+    Counter msgs_sent;
+    Counter bytes_sent;
+    Counter send_errors;
+    Latency_Histogram send_latency; // per sendmmsg() call
+    Latency_Histogram pacing_lateness;
+    Gauge replay_timestamp; // ITCH timestamp of the last packet paced
+    Gauge replay_lag;       // how late that packet was against the replay clock
+    Gauge time_to_first_packet;
+    Gauge rate_target;   // with --rate, msgs/s, packets/s or bit/s
+    Gauge rate_achieved; // over the current ramp step
+    Gauge pipeline_occupancy; // with --pipeline-depth, packets built ahead of the sender
+    Counter pipeline_starved; // packets the sender had to wait for the builder for
+
+    Downstream_Metrics(std::string_view session_, std::size_t channel_, std::chrono::steady_clock::time_point started_at_)
+        : session{session_},
+          channel{channel_},
+          started_at{started_at_}
+    {
+    }
+};
+
+// written only by one retransmission worker thread, for one session's channel
+struct alignas(64) Retransmission_Metrics
+{
+    std::string session;
+    std::size_t channel;
+    Counter requests;
+    Counter invalid_requests;
+    Counter cache_hits;
+    Counter cache_misses;
+    Counter buffer_hits;
+    Counter buffer_misses; // sequence not sent yet or before the buffer
+    Counter responses_sent;
+    Counter bytes_sent;
+    Counter dropped; // valid requests whose response was never sent
+    Counter throttled; // over the client's rate
+    Counter coalesced; // already answered by a response in flight to the same client
+    Latency_Histogram response_latency; // request received to response handed to the kernel
+
+    Retransmission_Metrics(std::string_view session_, std::size_t channel_)
+        : session{session_},
+          channel{channel_}
+    {
+    }
+};
+
+// written only by the channel's SoupBinTCP thread
+struct alignas(64) Soup_Bin_Metrics
+{
+    std::string session;
+    std::size_t channel;
+    Gauge clients; // connected, logged in or not
+    Counter logins;
+    Counter rejected_logins;
+    Counter timeouts; // clients dropped for not sending a heartbeat
+    Counter msgs_sent;
+    Counter bytes_sent;
+    Counter stalls; // writes cut short by a full socket buffer
+    Gauge max_client_lag; // messages the furthest behind client has left to catch up
+
+    Soup_Bin_Metrics(std::string_view session_, std::size_t channel_)
+        : session{session_},
+          channel{channel_}
+    {
+    }
+};
+
+// owns every thread's metrics, registration takes a lock but recording never does
+class Metrics
+{
+  public:
+    Downstream_Metrics& add_downstream(std::string_view session, std::size_t channel);
+    Retransmission_Metrics& add_retransmission(std::string_view session, std::size_t channel);
+    Soup_Bin_Metrics& add_soup_bin(std::string_view session, std::size_t channel);
+
+    // retransmission workers summed per session and channel, one `name{labels} value` line per metric
+    std::string snapshot() const;
+
+  private:
+    // construct first thing so time to first packet covers loading the file
+    const std::chrono::steady_clock::time_point started_at_{std::chrono::steady_clock::now()};
+    mutable std::mutex mutex_;
+    std::deque<Downstream_Metrics> downstream_;
+    std::deque<Retransmission_Metrics> retransmission_;
+    std::deque<Soup_Bin_Metrics> soup_bin_;
+};
+
+#endif
@@ -0,0 +1,159 @@
+#include "metrics_exporter.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <print>
+#include <stdexcept>
+#include <system_error>
+
+namespace
+{
+// how often the exporter wakes to check for stop when nothing else is due
+constexpr std::chrono::milliseconds poll_interval{100};
+} // namespace
+
+Metrics_Exporter::Metrics_Exporter(const Metrics& metrics,
+                                   const std::filesystem::path& socket_path,
+                                   const std::filesystem::path& file_path,
+                                   std::chrono::milliseconds interval)
+    : metrics_{metrics},
+      socket_path_{socket_path},
+      file_path_{file_path},
+      interval_{interval}
+{
+    if (!socket_path_.empty())
+    {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (socket_path_.native().size() >= sizeof(addr.sun_path))
+        {
+            throw std::invalid_argument(std::format("metrics socket path too long {}", socket_path_.string()));
+        }
+        std::memcpy(addr.sun_path, socket_path_.c_str(), socket_path_.native().size());
+
+        listen_sock_.emplace(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+        std::filesystem::remove(socket_path_); // stale socket from a previous run
+        if (bind(listen_sock_->fd(), reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0 ||
+            listen(listen_sock_->fd(), SOMAXCONN) < 0)
+        {
+            throw std::system_error(errno, std::system_category(), "metrics socket");
+        }
+    }
+
+    if (listen_sock_ || !file_path_.empty())
+    {
+        thread_ = std::jthread{[this](const std::stop_token& stop) { run(stop); }};
+    }
+}
+
+Metrics_Exporter::~Metrics_Exporter()
+{
+    if (thread_.joinable())
+    {
+        thread_.request_stop();
+        thread_.join();
+    }
+    if (!file_path_.empty())
+    {
+        write_file(); // final totals
+    }
+    if (listen_sock_)
+    {
+        std::error_code ec;
+        std::filesystem::remove(socket_path_, ec);
+    }
+}
+
+void Metrics_Exporter::run(const std::stop_token& stop)
+{
+    auto next_write{std::chrono::steady_clock::now() + interval_};
+    while (!stop.stop_requested())
+    {
+        const auto now{std::chrono::steady_clock::now()};
+        if (!file_path_.empty() && now >= next_write)
+        {
+            write_file();
+            next_write = now + interval_;
+        }
+
+        auto timeout{poll_interval};
+        if (!file_path_.empty())
+        {
+            timeout = std::min(timeout, std::chrono::ceil<std::chrono::milliseconds>(next_write - now));
+        }
+
+        if (!listen_sock_)
+        {
+            std::this_thread::sleep_for(timeout);
+            continue;
+        }
+
+        pollfd pfd{.fd = listen_sock_->fd(), .events = POLLIN, .revents = 0};
+        const int ret{poll(&pfd, 1, static_cast<int>(timeout.count()))};
+        if (ret < 0 && errno != EINTR)
+        {
+            std::perror("poll");
+        }
+        else if (ret > 0)
+        {
+            serve_client();
+        }
+    }
+}
+
+void Metrics_Exporter::serve_client() const
+{
+    const jam_utils::FD client{accept4(listen_sock_->fd(), nullptr, nullptr, SOCK_CLOEXEC)};
+    if (client.fd() < 0)
+    {
+        std::perror("accept4");
+        return;
+    }
+
+    const auto snapshot{metrics_.snapshot()};
+    std::size_t written{0};
+    while (written < snapshot.size())
+    {
+        const auto ret{send(client.fd(), snapshot.data() + written, snapshot.size() - written, MSG_NOSIGNAL)};
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            std::perror("send");
+            return;
+        }
+        written += static_cast<std::size_t>(ret);
+    }
+}
+
+void Metrics_Exporter::write_file() const
+{
+    // readers never see a partial snapshot
+    auto tmp_path{file_path_};
+    tmp_path += ".tmp";
+    {
+        std::ofstream out{tmp_path, std::ios::trunc};
+        out << metrics_.snapshot();
+        if (!out)
+        {
+            std::perror("metrics file");
+            return;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, file_path_, ec);
+    if (ec)
+    {
+        std::println(std::cerr, "metrics file: {}", ec.message());
+    }
+}
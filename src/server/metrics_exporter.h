@@ -0,0 +1,40 @@
+#ifndef METRICS_EXPORTER_H
+#define METRICS_EXPORTER_H
+
+#include "metrics.h"
+
+#include "jamutils/M_Map.h"
+
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <thread>
+
+// serves Metrics::snapshot() off the hot path: to every client connecting to a UNIX
+// socket (e.g. `nc -U path`) and/or rewritten into a file every interval
+class Metrics_Exporter
+{
+  public:
+    Metrics_Exporter(const Metrics& metrics,
+                     const std::filesystem::path& socket_path,
+                     const std::filesystem::path& file_path,
+                     std::chrono::milliseconds interval);
+    ~Metrics_Exporter();
+
+    Metrics_Exporter(const Metrics_Exporter&) = delete;
+    Metrics_Exporter& operator=(const Metrics_Exporter&) = delete;
+
+  private:
+    void run(const std::stop_token& stop);
+    void serve_client() const;
+    void write_file() const;
+
+    const Metrics& metrics_;
+    std::filesystem::path socket_path_;
+    std::filesystem::path file_path_;
+    std::chrono::milliseconds interval_;
+    std::optional<jam_utils::FD> listen_sock_;
+    std::jthread thread_;
+};
+
+#endif
@@ -0,0 +1,129 @@
+#include "pacer.h"
+#include "config.h"
+
+#include <iostream>
+#include <print>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+namespace
+{
+#if defined(__x86_64__) || defined(__i386__)
+bool invariant_tsc()
+{
+    unsigned eax{}, ebx{}, ecx{}, edx{};
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0)
+    {
+        return false;
+    }
+    return (edx & (1U << 8U)) != 0;
+}
+
+std::uint64_t read_tsc()
+{
+    return __rdtsc();
+}
+
+void cpu_relax()
+{
+    _mm_pause();
+}
+#else
+bool invariant_tsc()
+{
+    return false;
+}
+
+std::uint64_t read_tsc()
+{
+    return 0;
+}
+
+void cpu_relax()
+{
+}
+#endif
+} // namespace
+
+const Tsc_Clock& Tsc_Clock::calibrated()
+{
+    static const Tsc_Clock clock;
+    return clock;
+}
+
+Tsc_Clock::Tsc_Clock()
+{
+    if (!invariant_tsc())
+    {
+        std::println(std::cerr, "TSC is not invariant, pacing with steady_clock");
+        return;
+    }
+
+    const auto start_time{std::chrono::steady_clock::now()};
+    const auto start_tsc{read_tsc()};
+    std::this_thread::sleep_for(config::tsc_calibration_time);
+    const auto end_time{std::chrono::steady_clock::now()};
+    const auto end_tsc{read_tsc()};
+
+    ns_per_tick_ = static_cast<double>(std::chrono::nanoseconds{end_time - start_time}.count()) /
+                   static_cast<double>(end_tsc - start_tsc);
+    base_tsc_ = end_tsc;
+    base_time_ = end_time;
+    uses_tsc_ = true;
+}
+
+Tsc_Clock::time_point Tsc_Clock::now() const
+{
+    if (!uses_tsc_)
+    {
+        return std::chrono::steady_clock::now();
+    }
+    const auto ticks{static_cast<double>(read_tsc() - base_tsc_)};
+    return base_time_ + std::chrono::nanoseconds{static_cast<std::int64_t>(ticks * ns_per_tick_)};
+}
+
+Pacer::Pacer(Pacing_Mode mode, std::chrono::microseconds spin_threshold)
+    : mode_{mode},
+      spin_threshold_{spin_threshold},
+      clock_{mode == Pacing_Mode::sleep ? nullptr : &Tsc_Clock::calibrated()}
+{
+}
+
+Pacer::time_point Pacer::now() const
+{
+    return clock_ != nullptr ? clock_->now() : std::chrono::steady_clock::now();
+}
+
+std::chrono::nanoseconds Pacer::wait_until(time_point target)
+{
+    switch (mode_)
+    {
+    case Pacing_Mode::sleep:
+        std::this_thread::sleep_until(target);
+        break;
+    case Pacing_Mode::hybrid:
+        // the target is on the TSC clock, sleep_until() wants a steady_clock deadline
+        if (const auto remaining{target - now()}; remaining > spin_threshold_)
+        {
+            std::this_thread::sleep_until(std::chrono::steady_clock::now() + (remaining - spin_threshold_));
+        }
+        spin_until(target);
+        break;
+    case Pacing_Mode::spin:
+        spin_until(target);
+        break;
+    }
+    return now() - target;
+}
+
+void Pacer::spin_until(time_point target) const
+{
+    while (clock_->now() < target)
+    {
+        cpu_relax();
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+
+// steady_clock read from the TSC: ~10ns instead of a vDSO call, which matters when
+// spinning. Calibrated once against steady_clock, so it drifts from steady_clock by the
+// calibration error and any NTP slew: only compare its time_points with each other.
+// Falls back to steady_clock when the TSC is not invariant or this is not x86
+class Tsc_Clock
+{
+  public:
+    using time_point = std::chrono::steady_clock::time_point;
+
+    static const Tsc_Clock& calibrated();
+
+    time_point now() const;
+
+    bool uses_tsc() const { return uses_tsc_; }
+
+  private:
+    Tsc_Clock();
+
+    bool uses_tsc_{false};
+    double ns_per_tick_{0};
+    std::uint64_t base_tsc_{0};
+    time_point base_time_{};
+};
+
+enum class Pacing_Mode
+{
+    sleep,  // sleep_until(), cheapest but every wakeup pays the scheduler latency
+    hybrid, // sleep until spin_threshold before the target then spin on the TSC
+    spin    // spin on the TSC, burns the core
+};
+
+// for CLI11
+const std::map<std::string, Pacing_Mode> pacing_mode_map{{"sleep", Pacing_Mode::sleep},
+                                                         {"hybrid", Pacing_Mode::hybrid},
+                                                         {"spin", Pacing_Mode::spin}};
+
+// waits for packet send times
+class Pacer
+{
+  public:
+    using time_point = Tsc_Clock::time_point;
+
+    Pacer(Pacing_Mode mode, std::chrono::microseconds spin_threshold);
+
+    time_point now() const;
+
+    // returns how late the wait returned, negative if early
+    std::chrono::nanoseconds wait_until(time_point target);
+
+  private:
+    void spin_until(time_point target) const;
+
+    Pacing_Mode mode_;
+    std::chrono::microseconds spin_threshold_;
+    const Tsc_Clock* clock_{nullptr}; // only calibrated for the spinning modes
+};
+
+#endif
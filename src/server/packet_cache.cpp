@@ -0,0 +1,109 @@
+#include "packet_cache.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+template <typename T>
+T load(T& field)
+{
+    return std::atomic_ref<T>{field}.load(std::memory_order_relaxed);
+}
+
+template <typename T>
+void store(T& field, T value)
+{
+    std::atomic_ref<T>{field}.store(value, std::memory_order_relaxed);
+}
+} // namespace
+
+Packet_Cache::Packet_Cache(std::size_t num_slots)
+    : slots_{std::make_unique<Slot[]>(num_slots)},
+      mask_{num_slots - 1}
+{
+    if (!std::has_single_bit(num_slots))
+    {
+        throw std::invalid_argument("packet cache slots must be a power of 2");
+    }
+}
+
+Packet_Cache::Slot& Packet_Cache::slot_for(std::uint64_t seq, std::uint16_t msg_count)
+{
+    // fibonacci hash, neighbouring gap requests land in different slots
+    const auto hash{(seq ^ (std::uint64_t{msg_count} << 48U)) * 0x9E3779B97F4A7C15ULL};
+    return slots_[(hash >> 32U) & mask_];
+}
+
+std::size_t Packet_Cache::find(std::uint64_t seq,
+                               std::uint16_t msg_count,
+                               std::span<std::byte, mold_udp_64::max_payload_size> out)
+{
+    auto& slot{slot_for(seq, msg_count)};
+
+    const auto version{slot.version.load(std::memory_order_acquire)};
+    if (version % 2 != 0 || load(slot.seq) != seq || load(slot.msg_count) != msg_count)
+    {
+        return 0;
+    }
+    // may be torn by a racing writer, the version check below catches it
+    const std::size_t len{std::min<std::size_t>(load(slot.len), out.size())};
+    for (std::size_t i = 0; i * sizeof(std::uint64_t) < len; ++i)
+    {
+        const auto word{load(slot.packet[i])};
+        std::memcpy(out.data() + i * sizeof(word), &word, std::min(sizeof(word), len - i * sizeof(word)));
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if (len == 0 || slot.version.load(std::memory_order_relaxed) != version)
+    {
+        return 0;
+    }
+    return len;
+}
+
+void Packet_Cache::insert(std::uint64_t seq,
+                          std::uint16_t msg_count,
+                          std::span<const iovec> packet)
+{
+    std::size_t len{0};
+    for (const auto& iov : packet)
+    {
+        len += iov.iov_len;
+    }
+    if (len > mold_udp_64::max_payload_size)
+    {
+        return;
+    }
+
+    // gathered first so the slot is written a word at a time
+    std::array<std::uint64_t, packet_words> words{};
+    auto* dst{reinterpret_cast<std::byte*>(words.data())};
+    for (const auto& iov : packet)
+    {
+        std::memcpy(dst, iov.iov_base, iov.iov_len);
+        dst += iov.iov_len;
+    }
+
+    auto& slot{slot_for(seq, msg_count)};
+
+    auto version{slot.version.load(std::memory_order_relaxed)};
+    if (version % 2 != 0 ||
+        !slot.version.compare_exchange_strong(version, version + 1, std::memory_order_acquire))
+    {
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+
+    store(slot.seq, seq);
+    store(slot.msg_count, msg_count);
+    store(slot.len, static_cast<std::uint16_t>(len));
+    for (std::size_t i = 0; i * sizeof(std::uint64_t) < len; ++i)
+    {
+        store(slot.packet[i], words[i]);
+    }
+
+    slot.version.store(version + 2, std::memory_order_release);
+}
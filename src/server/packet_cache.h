@@ -0,0 +1,51 @@
+#ifndef PACKET_CACHE_H
+#define PACKET_CACHE_H
+
+#include "mold_udp_64.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <sys/uio.h>
+
+// direct mapped cache of built retransmission responses keyed by (start seq, msg count),
+// shared by every worker. Each slot is a seqlock so lookups and inserts never block: a
+// reader that races a writer just misses and a writer that races another writer skips.
+// Slot contents are only accessed through relaxed std::atomic_ref so the racing read is
+// defined, the version check then discards it
+class Packet_Cache
+{
+  public:
+    explicit Packet_Cache(std::size_t num_slots);
+
+    // copies the cached packet into out, returns its length or 0 on a miss
+    std::size_t find(std::uint64_t seq,
+                     std::uint16_t msg_count,
+                     std::span<std::byte, mold_udp_64::max_payload_size> out);
+
+    void insert(std::uint64_t seq,
+                std::uint16_t msg_count,
+                std::span<const iovec> packet);
+
+  private:
+    static constexpr std::size_t packet_words{(mold_udp_64::max_payload_size + 7) / 8};
+
+    struct alignas(64) Slot
+    {
+        std::atomic<std::uint64_t> version{0}; // odd while being written
+        std::uint64_t seq{};
+        std::uint16_t msg_count{};
+        std::uint16_t len{};
+        std::array<std::uint64_t, packet_words> packet;
+    };
+
+    Slot& slot_for(std::uint64_t seq, std::uint16_t msg_count);
+
+    std::unique_ptr<Slot[]> slots_;
+    std::size_t mask_;
+};
+
+#endif
@@ -0,0 +1,158 @@
+#include "packet_file.h"
+#include "itch.h"
+#include "message_filter.h"
+#include "mold_udp_64.h"
+#include "packetizer.h"
+
+#include <algorithm>
+#include <format>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+// packets buffered before each write while building
+constexpr std::size_t write_batch{1U << 16U};
+} // namespace
+
+std::filesystem::path Packet_File::sidecar_path(const std::filesystem::path& itch_file_path)
+{
+    auto path{itch_file_path};
+    path += ".pkt";
+    return path;
+}
+
+void Packet_File::build(const std::filesystem::path& itch_file_path,
+                        const Itch_File& itch_file,
+                        std::size_t payload_size,
+                        std::chrono::nanoseconds max_delay)
+{
+    if (constexpr auto min_payload_size{sizeof(mold_udp_64::Downstream_Header) + itch::len_prefix_size + itch::max_msg_len};
+        payload_size < min_payload_size || payload_size > mold_udp_64::max_jumbo_mtu_size - mold_udp_64::udp_header_size)
+    {
+        throw std::invalid_argument(std::format("payload size {} outside [{}, {}]",
+                                                payload_size,
+                                                min_payload_size,
+                                                mold_udp_64::max_jumbo_mtu_size - mold_udp_64::udp_header_size));
+    }
+
+    const Message_Filter filter{};
+    const Packetizer packetizer{itch_file, filter, payload_size, max_delay};
+    // only the boundaries are kept, the session is the replay's
+    mold_udp_64::Response_Context res_ctx{std::string(mold_udp_64::session_len, ' '), payload_size};
+
+    Header header{.magic = magic,
+                  .itch_file_len = itch_file.len(),
+                  .itch_file_mtime = Itch_File::mtime(itch_file_path),
+                  .payload_size = payload_size,
+                  .max_delay = static_cast<std::uint64_t>(max_delay.count()),
+                  .packet_count = 0,
+                  .msg_count = 0};
+
+    const auto path{sidecar_path(itch_file_path)};
+    auto tmp_path{path};
+    tmp_path += ".tmp";
+    {
+        std::ofstream out{tmp_path, std::ios::binary | std::ios::trunc};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        std::vector<Packet> packets;
+        packets.reserve(write_batch);
+        const auto write{[&] {
+            out.write(reinterpret_cast<const char*>(packets.data()),
+                      static_cast<std::streamsize>(packets.size() * sizeof(Packet)));
+            packets.clear();
+        }};
+
+        while (res_ctx.file_pos < itch_file.len())
+        {
+            if (!packetizer.fill(res_ctx, UINT16_MAX))
+            {
+                throw std::runtime_error("ITCH message truncated at eof");
+            }
+            // same as the downstream, a delay bound sends a packet at its last message's time
+            const auto paced_by{max_delay.count() > 0 ? res_ctx.last_msg_pos : res_ctx.runs[0].pos};
+            packets.push_back({res_ctx.runs[0].pos,
+                               header.msg_count + 1,
+                               itch::extract_timestamp(itch_file.at(paced_by)),
+                               static_cast<std::uint32_t>(res_ctx.payload_len),
+                               res_ctx.header.msg_count});
+            header.msg_count += res_ctx.header.msg_count;
+            ++header.packet_count;
+            if (packets.size() == write_batch)
+            {
+                write();
+            }
+        }
+        write();
+
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        if (!out)
+        {
+            throw std::runtime_error(std::format("failed writing packet file {}", tmp_path.string()));
+        }
+    }
+    std::filesystem::rename(tmp_path, path);
+}
+
+bool Packet_File::is_current(const std::filesystem::path& itch_file_path,
+                             const Itch_File& itch_file,
+                             std::size_t payload_size,
+                             std::chrono::nanoseconds max_delay)
+{
+    std::ifstream in{sidecar_path(itch_file_path), std::ios::binary};
+    Header header{};
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)))
+    {
+        return false;
+    }
+    return header.magic == magic &&
+           header.itch_file_len == itch_file.len() &&
+           header.itch_file_mtime == Itch_File::mtime(itch_file_path) &&
+           header.payload_size == payload_size &&
+           header.max_delay == static_cast<std::uint64_t>(max_delay.count());
+}
+
+Packet_File::Packet_File(const std::filesystem::path& itch_file_path)
+    : sidecar_{sidecar_path(itch_file_path), PROT_READ, MAP_PRIVATE, 0},
+      header_{reinterpret_cast<const Header*>(sidecar_.at(0))}
+{
+    if (sidecar_.len() < sizeof(Header) || header_->magic != magic ||
+        sidecar_.len() != sizeof(Header) + header_->packet_count * sizeof(Packet))
+    {
+        throw std::runtime_error(std::format("malformed packet file {}", sidecar_path(itch_file_path).string()));
+    }
+    if (header_->packet_count > 0)
+    {
+        packets_ = {reinterpret_cast<const Packet*>(sidecar_.at(sizeof(Header))),
+                    header_->packet_count};
+    }
+}
+
+std::size_t Packet_File::seek(std::chrono::nanoseconds timestamp) const
+{
+    const auto it{std::ranges::partition_point(packets_, [timestamp](const Packet& packet) {
+        return packet.timestamp < static_cast<std::uint64_t>(timestamp.count());
+    })};
+    return static_cast<std::size_t>(it - packets_.begin());
+}
+
+const Packet_File::Packet* Packet_File::find(std::uint64_t seq) const
+{
+    const auto it{std::ranges::partition_point(packets_, [seq](const Packet& packet) {
+        return packet.seq_num + packet.msg_count <= seq;
+    })};
+    if (it == packets_.end() || seq < it->seq_num)
+    {
+        return nullptr;
+    }
+    return &*it;
+}
+
+std::uint64_t Packet_File::msg_count() const
+{
+    return header_->msg_count;
+}
@@ -0,0 +1,77 @@
+#ifndef PACKET_FILE_H
+#define PACKET_FILE_H
+
+#include "itch_file.h"
+
+#include "jamutils/M_Map.h"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+
+// the downstream packetization of an itch file compiled ahead of the replay
+// (<itch file>.pkt) for one payload size and packet delay bound: each packet's file
+// position, length, first sequence number, message count and the timestamp it is paced by.
+// Unfiltered packets are contiguous slices of the file so the payloads themselves are
+// sent straight from the itch file's mapping and only the header is written at runtime
+class Packet_File
+{
+  public:
+    struct Packet
+    {
+        std::uint64_t file_pos;
+        std::uint64_t seq_num;
+        std::uint64_t timestamp; // ns
+        std::uint32_t payload_len;
+        std::uint32_t msg_count;
+    };
+
+    static std::filesystem::path sidecar_path(const std::filesystem::path& itch_file_path);
+
+    static void build(const std::filesystem::path& itch_file_path,
+                      const Itch_File& itch_file,
+                      std::size_t payload_size,
+                      std::chrono::nanoseconds max_delay);
+
+    // false if the sidecar is missing, was built for a different version of the file or
+    // packetizes differently
+    static bool is_current(const std::filesystem::path& itch_file_path,
+                           const Itch_File& itch_file,
+                           std::size_t payload_size,
+                           std::chrono::nanoseconds max_delay);
+
+    explicit Packet_File(const std::filesystem::path& itch_file_path);
+
+    std::span<const Packet> packets() const { return packets_; }
+
+    // index of the first packet paced at or after timestamp
+    std::size_t seek(std::chrono::nanoseconds timestamp) const;
+
+    // packet carrying seq, nullptr past the end
+    const Packet* find(std::uint64_t seq) const;
+
+    std::uint64_t msg_count() const;
+
+  private:
+    struct __attribute__((__packed__)) Header
+    {
+        std::array<char, 8> magic;
+        std::uint64_t itch_file_len;
+        std::int64_t itch_file_mtime;
+        std::uint64_t payload_size;
+        std::uint64_t max_delay;
+        std::uint64_t packet_count;
+        std::uint64_t msg_count;
+    };
+
+    static constexpr std::array<char, 8> magic{'I', 'M', 'R', 'P', 'K', 'T', '0', '1'};
+
+    jam_utils::M_Map sidecar_;
+    const Header* header_;
+    std::span<const Packet> packets_;
+};
+
+#endif
@@ -0,0 +1,228 @@
+#include "packet_ring.h"
+#include "config.h"
+
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+namespace
+{
+// tpacket2_hdr then the frame, the sockaddr_ll slot in TPACKET2_HDRLEN is only used on rx
+constexpr std::size_t frame_data_offset{TPACKET_ALIGN(sizeof(tpacket2_hdr))};
+constexpr std::size_t eth_header_size{sizeof(ether_header)};
+constexpr std::size_t ip_header_size{sizeof(iphdr)};
+
+std::uint16_t ip_checksum(const std::byte* header)
+{
+    std::uint32_t sum{0};
+    for (std::size_t i = 0; i < ip_header_size; i += 2)
+    {
+        std::uint16_t word{};
+        std::memcpy(&word, header + i, sizeof(word));
+        sum += word;
+    }
+    while (sum >> 16U != 0)
+    {
+        sum = (sum & 0xffffU) + (sum >> 16U);
+    }
+    return static_cast<std::uint16_t>(~sum);
+}
+
+std::atomic_ref<std::uint32_t> frame_status(std::byte* frame)
+{
+    return std::atomic_ref<std::uint32_t>{reinterpret_cast<tpacket2_hdr*>(frame)->tp_status};
+}
+} // namespace
+
+Packet_Ring::Packet_Ring(std::string_view interface,
+                         const sockaddr_in& group,
+                         in_port_t source_port,
+                         std::uint8_t ttl,
+                         std::size_t max_payload_size)
+    : sock_{socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0)}, // protocol 0, transmit only
+      max_payload_size_{max_payload_size},
+      frame_size_{std::bit_ceil(frame_data_offset + frame_header_size + max_payload_size)},
+      frame_count_{config::tx_ring_frames},
+      ring_len_{frame_size_ * frame_count_}
+{
+    const auto group_addr{ntohl(group.sin_addr.s_addr)};
+    if ((group_addr & 0xf0000000U) != 0xe0000000U)
+    {
+        throw std::invalid_argument("packet ring transmitter needs a multicast downstream group");
+    }
+
+    ifreq ifr{};
+    if (interface.empty() || interface.size() >= sizeof(ifr.ifr_name))
+    {
+        throw std::invalid_argument(std::format("invalid interface name {}", interface));
+    }
+    const auto request{[&](unsigned long req, const char* what) {
+        std::memcpy(ifr.ifr_name, interface.data(), interface.size());
+        if (ioctl(sock_.fd(), req, &ifr) < 0)
+        {
+            throw std::system_error(errno, std::system_category(), std::format("{} {}", what, interface));
+        }
+    }};
+
+    request(SIOCGIFINDEX, "interface index of");
+    addr_.sll_family = AF_PACKET;
+    addr_.sll_protocol = htons(ETH_P_IP);
+    addr_.sll_ifindex = ifr.ifr_ifindex;
+
+    request(SIOCGIFMTU, "mtu of");
+    if (const auto ip_len{ip_header_size + sizeof(udphdr) + max_payload_size};
+        ip_len > static_cast<std::size_t>(ifr.ifr_mtu))
+    {
+        throw std::invalid_argument(std::format("{} byte packets exceed {}'s mtu of {}", ip_len, interface, ifr.ifr_mtu));
+    }
+
+    // the group's MAC is 01:00:5e and its low 23 bits
+    ether_header eth{};
+    eth.ether_dhost[0] = 0x01;
+    eth.ether_dhost[1] = 0x00;
+    eth.ether_dhost[2] = 0x5e;
+    eth.ether_dhost[3] = static_cast<std::uint8_t>((group_addr >> 16U) & 0x7fU);
+    eth.ether_dhost[4] = static_cast<std::uint8_t>(group_addr >> 8U);
+    eth.ether_dhost[5] = static_cast<std::uint8_t>(group_addr);
+    request(SIOCGIFHWADDR, "hardware address of");
+    std::memcpy(eth.ether_shost, ifr.ifr_hwaddr.sa_data, sizeof(eth.ether_shost));
+    eth.ether_type = htons(ETHERTYPE_IP);
+    std::memcpy(addr_.sll_addr, eth.ether_dhost, sizeof(eth.ether_dhost));
+    addr_.sll_halen = sizeof(eth.ether_dhost);
+
+    request(SIOCGIFADDR, "ipv4 address of");
+    sockaddr_in source{};
+    std::memcpy(&source, &ifr.ifr_addr, sizeof(source));
+
+    iphdr ip{};
+    ip.version = 4;
+    ip.ihl = ip_header_size / 4;
+    ip.frag_off = htons(IP_DF);
+    ip.ttl = ttl;
+    ip.protocol = IPPROTO_UDP;
+    ip.saddr = source.sin_addr.s_addr;
+    ip.daddr = group.sin_addr.s_addr;
+
+    udphdr udp{};
+    udp.source = source_port;
+    udp.dest = group.sin_port;
+
+    std::memcpy(frame_header_.data(), &eth, sizeof(eth));
+    std::memcpy(frame_header_.data() + eth_header_size, &ip, sizeof(ip));
+    std::memcpy(frame_header_.data() + eth_header_size + ip_header_size, &udp, sizeof(udp));
+
+    constexpr int version{TPACKET_V2};
+    constexpr int loss{1}; // a malformed frame is skipped and marked rather than stalling the ring
+    const auto block_size{std::max(frame_size_, static_cast<std::size_t>(sysconf(_SC_PAGESIZE)))};
+    tpacket_req req{static_cast<unsigned>(block_size),
+                    static_cast<unsigned>(ring_len_ / block_size),
+                    static_cast<unsigned>(frame_size_),
+                    static_cast<unsigned>(frame_count_)};
+    if (setsockopt(sock_.fd(), SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0 ||
+        setsockopt(sock_.fd(), SOL_PACKET, PACKET_LOSS, &loss, sizeof(loss)) < 0 ||
+        setsockopt(sock_.fd(), SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0)
+    {
+        throw std::system_error(errno, std::system_category(), "PACKET_TX_RING");
+    }
+
+    void* ring{mmap(nullptr, ring_len_, PROT_READ | PROT_WRITE, MAP_SHARED, sock_.fd(), 0)};
+    if (ring == MAP_FAILED)
+    {
+        throw std::system_error(errno, std::system_category(), "mapping PACKET_TX_RING");
+    }
+    ring_ = static_cast<std::byte*>(ring);
+}
+
+Packet_Ring::~Packet_Ring()
+{
+    munmap(ring_, ring_len_);
+}
+
+bool Packet_Ring::queue(const iovec* iov, std::size_t iov_len)
+{
+    auto* const frame_start{frame(head_)};
+    if (frame_status(frame_start).load(std::memory_order_acquire) != TP_STATUS_AVAILABLE)
+    {
+        send();
+        if (frame_status(frame_start).load(std::memory_order_acquire) != TP_STATUS_AVAILABLE)
+        {
+            return false;
+        }
+    }
+
+    auto* const data{frame_start + frame_data_offset};
+    std::size_t payload_len{0};
+    for (std::size_t i = 0; i < iov_len; ++i)
+    {
+        if (payload_len + iov[i].iov_len > max_payload_size_)
+        {
+            return false;
+        }
+        std::memcpy(data + frame_header_size + payload_len, iov[i].iov_base, iov[i].iov_len);
+        payload_len += iov[i].iov_len;
+    }
+
+    std::memcpy(data, frame_header_.data(), frame_header_.size());
+    auto* const ip_header{data + eth_header_size};
+    const auto ip_len{htons(static_cast<std::uint16_t>(ip_header_size + sizeof(udphdr) + payload_len))};
+    const auto ip_id{htons(ip_id_++)};
+    const auto udp_len{htons(static_cast<std::uint16_t>(sizeof(udphdr) + payload_len))};
+    std::memcpy(ip_header + offsetof(iphdr, tot_len), &ip_len, sizeof(ip_len));
+    std::memcpy(ip_header + offsetof(iphdr, id), &ip_id, sizeof(ip_id));
+    const auto checksum{ip_checksum(ip_header)};
+    std::memcpy(ip_header + offsetof(iphdr, check), &checksum, sizeof(checksum));
+    std::memcpy(ip_header + ip_header_size + offsetof(udphdr, len), &udp_len, sizeof(udp_len));
+
+    reinterpret_cast<tpacket2_hdr*>(frame_start)->tp_len = static_cast<std::uint32_t>(frame_header_size + payload_len);
+    frame_status(frame_start).store(TP_STATUS_SEND_REQUEST, std::memory_order_release);
+    head_ = (head_ + 1) % frame_count_;
+    ++queued_;
+    return true;
+}
+
+std::size_t Packet_Ring::flush()
+{
+    send();
+    return std::exchange(dropped_, 0);
+}
+
+void Packet_Ring::send()
+{
+    if (queued_ == 0)
+    {
+        return;
+    }
+    // blocking, returns once the kernel has handed every frame to the driver
+    if (sendto(sock_.fd(), nullptr, 0, 0, reinterpret_cast<const sockaddr*>(&addr_), sizeof(addr_)) < 0)
+    {
+        std::perror("sendto PACKET_TX_RING");
+    }
+
+    for (std::size_t i = 0; i < queued_; ++i)
+    {
+        auto* const frame_start{frame((head_ + frame_count_ - queued_ + i) % frame_count_)};
+        if (frame_status(frame_start).load(std::memory_order_acquire) == TP_STATUS_WRONG_FORMAT)
+        {
+            frame_status(frame_start).store(TP_STATUS_AVAILABLE, std::memory_order_release);
+            ++dropped_;
+        }
+    }
+    queued_ = 0;
+}
@@ -0,0 +1,60 @@
+#ifndef PACKET_RING_H
+#define PACKET_RING_H
+
+#include "jamutils/M_Map.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <linux/if_packet.h>
+#include <netinet/in.h>
+#include <sys/uio.h>
+
+// downstream transmitter skipping the kernel's UDP/IP stack: whole Ethernet/IPv4/UDP frames
+// are written into an AF_PACKET PACKET_TX_RING shared with the kernel, and one send() hands
+// every frame queued to the driver. The destination MAC is the group's multicast MAC and the
+// source MAC and address are the interface's, so nothing needs resolving. The UDP checksum
+// is left 0 (none) as IPv4 allows
+class Packet_Ring
+{
+  public:
+    static constexpr std::size_t frame_header_size{14 + 20 + 8}; // Ethernet, IPv4 and UDP
+
+    // source_port in network order, as in sin_port
+    Packet_Ring(std::string_view interface,
+                const sockaddr_in& group,
+                in_port_t source_port,
+                std::uint8_t ttl,
+                std::size_t max_payload_size);
+    ~Packet_Ring();
+
+    Packet_Ring(const Packet_Ring&) = delete;
+    Packet_Ring& operator=(const Packet_Ring&) = delete;
+
+    // copies the UDP payload into the next frame, flushing first when the ring is full
+    bool queue(const iovec* iov, std::size_t iov_len);
+
+    // sends every frame queued and waits for the kernel to release them, returns how many it
+    // dropped since the last flush(), including in flushes queue() made when the ring was full
+    std::size_t flush();
+
+  private:
+    void send();
+    std::byte* frame(std::size_t i) const { return ring_ + i * frame_size_; }
+
+    jam_utils::FD sock_;
+    sockaddr_ll addr_{};
+    std::array<std::byte, frame_header_size> frame_header_{};
+    std::size_t max_payload_size_;
+    std::size_t frame_size_;
+    std::size_t frame_count_;
+    std::size_t ring_len_;
+    std::byte* ring_{};
+    std::size_t head_{0};   // next frame to fill
+    std::size_t queued_{0}; // frames filled since the last send
+    std::size_t dropped_{0}; // frames the kernel rejected since the last flush()
+    std::uint16_t ip_id_{0};
+};
+
+#endif
@@ -0,0 +1,83 @@
+#include "packetizer.h"
+#include "itch.h"
+
+Packetizer::Packetizer(const Itch_File& itch_file,
+                       const Message_Filter& filter,
+                       std::size_t payload_size,
+                       std::chrono::nanoseconds max_delay)
+    : itch_file_{itch_file},
+      filter_{filter},
+      payload_size_{payload_size},
+      max_delay_{static_cast<std::uint64_t>(max_delay.count())}
+{
+}
+
+bool Packetizer::fill(mold_udp_64::Response_Context& res_ctx,
+                      std::uint16_t max_msgs,
+                      Message_Buffer* msg_buffer,
+                      std::uint64_t first_seq) const
+{
+    res_ctx.header.msg_count = 0;
+    res_ctx.clear_payload();
+
+    auto pos{res_ctx.file_pos};
+    std::uint64_t first_timestamp{0};
+    // a streamed file may still be growing, wait for enough bytes for the longest message
+    while (res_ctx.header.msg_count < max_msgs)
+    {
+        const auto available{itch_file_.ensure(pos + itch::len_prefix_size + itch::max_msg_len)};
+        if (pos >= available)
+        {
+            break;
+        }
+
+        if (pos + itch::len_prefix_size > available)
+        {
+            res_ctx.file_pos = pos;
+            return false;
+        }
+
+        const std::size_t total_msg_len{itch::len_prefix_size + itch::extract_len(itch_file_.at(pos))};
+
+        if (pos + total_msg_len > available)
+        {
+            res_ctx.file_pos = pos;
+            return false;
+        }
+
+        if (!filter_.accept(itch_file_.at(pos)))
+        {
+            pos += total_msg_len;
+            continue;
+        }
+
+        if (res_ctx.packet_len() + total_msg_len > payload_size_)
+        {
+            break;
+        }
+
+        if (max_delay_ != 0)
+        {
+            const auto timestamp{itch::extract_timestamp(itch_file_.at(pos))};
+            if (res_ctx.header.msg_count == 0)
+            {
+                first_timestamp = timestamp;
+            }
+            else if (timestamp > first_timestamp + max_delay_)
+            {
+                break;
+            }
+        }
+
+        if (msg_buffer != nullptr)
+        {
+            msg_buffer->push(first_seq + res_ctx.header.msg_count, pos);
+        }
+
+        res_ctx.append(pos, total_msg_len);
+        pos += total_msg_len;
+        ++res_ctx.header.msg_count;
+    }
+    res_ctx.file_pos = pos;
+    return true;
+}
@@ -0,0 +1,41 @@
+#ifndef PACKETIZER_H
+#define PACKETIZER_H
+
+#include "itch_file.h"
+#include "message_buffer.h"
+#include "message_filter.h"
+#include "mold_udp_64.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// packs whole ITCH messages from the file into a packet, shared by downstream
+// packetization and retransmission responses
+class Packetizer
+{
+  public:
+    // packets are closed at payload_size (the UDP payload) and, if max_delay is set, before a
+    // message timestamped more than max_delay after the packet's first
+    Packetizer(const Itch_File& itch_file,
+               const Message_Filter& filter,
+               std::size_t payload_size = mold_udp_64::max_payload_size,
+               std::chrono::nanoseconds max_delay = {});
+
+    // resets res_ctx's payload and appends the messages the filter accepts from
+    // res_ctx.file_pos until the packet is full, max_msgs were added or eof, leaving
+    // file_pos after the last message taken. Each message is pushed into msg_buffer, if
+    // given, numbered from first_seq. Returns false if stopped by a message truncated at eof
+    bool fill(mold_udp_64::Response_Context& res_ctx,
+              std::uint16_t max_msgs,
+              Message_Buffer* msg_buffer = nullptr,
+              std::uint64_t first_seq = 0) const;
+
+  private:
+    const Itch_File& itch_file_;
+    const Message_Filter& filter_;
+    const std::size_t payload_size_;
+    const std::uint64_t max_delay_; // ns, 0 for none
+};
+
+#endif
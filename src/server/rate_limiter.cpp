@@ -0,0 +1,100 @@
+#include "rate_limiter.h"
+#include "mold_udp_64.h"
+
+#include <algorithm>
+#include <format>
+#include <stdexcept>
+
+const char* to_string(Rate_Unit unit)
+{
+    switch (unit)
+    {
+    case Rate_Unit::packets:
+        return "packets/s";
+    case Rate_Unit::mbps:
+        return "Mbit/s";
+    default:
+        return "msgs/s";
+    }
+}
+
+Rate_Limiter::Rate_Limiter(Rate_Unit unit,
+                           double rate,
+                           double burst,
+                           double ramp_step,
+                           std::chrono::seconds ramp_interval,
+                           double max_rate)
+    : unit_{unit},
+      scale_{unit == Rate_Unit::mbps ? 1e6 : 1.0},
+      rate_{rate * scale_},
+      burst_{burst * scale_},
+      ramp_step_{ramp_step * scale_},
+      ramp_interval_{ramp_interval},
+      max_rate_{max_rate * scale_}
+{
+    if (rate <= 0 || burst < 0 || ramp_step < 0 || max_rate < 0)
+    {
+        throw std::invalid_argument(std::format("rate {} must be positive, burst, ramp step and max rate non negative", rate));
+    }
+    if (ramp_step > 0 && ramp_interval.count() <= 0)
+    {
+        throw std::invalid_argument("ramp interval must be positive");
+    }
+}
+
+Rate_Limiter::time_point Rate_Limiter::reserve(std::size_t msgs, std::size_t packet_len, time_point now)
+{
+    if (!started_)
+    {
+        started_ = true;
+        full_at_ = now;
+        step_start_ = now;
+    }
+    while (ramp_step_ > 0 && now >= step_start_ + ramp_interval_)
+    {
+        next_step();
+    }
+
+    // the bucket holds burst_ tokens, so a packet may go once the debt left is within that
+    const auto units{cost(msgs, packet_len)};
+    const std::chrono::nanoseconds tolerance{static_cast<std::int64_t>(burst_ / rate_ * 1e9)};
+    const std::chrono::nanoseconds interval{static_cast<std::int64_t>(units / rate_ * 1e9)};
+    const auto send_at{std::max(now, full_at_ - tolerance)};
+    // a sender which fell behind doesn't earn tokens for the time it was late beyond the burst
+    full_at_ = std::max(full_at_, send_at) + interval;
+    step_units_ += units;
+    return send_at;
+}
+
+double Rate_Limiter::achieved(time_point now) const
+{
+    const std::chrono::duration<double> elapsed{now - step_start_};
+    return !started_ || elapsed.count() <= 0 ? 0 : step_units_ / elapsed.count() / scale_;
+}
+
+double Rate_Limiter::cost(std::size_t msgs, std::size_t packet_len) const
+{
+    switch (unit_)
+    {
+    case Rate_Unit::packets:
+        return 1;
+    case Rate_Unit::mbps:
+        return static_cast<double>((packet_len + mold_udp_64::udp_header_size) * 8);
+    default:
+        return static_cast<double>(msgs);
+    }
+}
+
+void Rate_Limiter::next_step()
+{
+    previous_rate_ = rate_;
+    previous_achieved_ = step_units_ / std::chrono::duration<double>{ramp_interval_}.count();
+    rate_ += ramp_step_;
+    if (max_rate_ > 0)
+    {
+        rate_ = std::min(rate_, max_rate_);
+    }
+    step_start_ += ramp_interval_;
+    step_units_ = 0;
+    ++step_;
+}
@@ -0,0 +1,78 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include "pacer.h"
+
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <string>
+
+enum class Rate_Unit
+{
+    msgs,
+    packets,
+    mbps // Mbit/s of IP datagrams
+};
+
+// for CLI11
+const std::map<std::string, Rate_Unit> rate_unit_map{{"msgs", Rate_Unit::msgs},
+                                                     {"packets", Rate_Unit::packets},
+                                                     {"mbps", Rate_Unit::mbps}};
+
+const char* to_string(Rate_Unit unit);
+
+// token bucket pacing to a fixed rate instead of the ITCH timestamps, for a steady known load.
+// Kept as the time the bucket would next be full (GCRA) so each packet is one subtraction
+// and compare. Rates and burst are in the unit given, the target can step up by ramp_step
+// every ramp_interval until max_rate (0 for no cap). The schedule starts with the first packet
+class Rate_Limiter
+{
+  public:
+    using time_point = Pacer::time_point;
+
+    Rate_Limiter(Rate_Unit unit,
+                 double rate,
+                 double burst,
+                 double ramp_step = 0,
+                 std::chrono::seconds ramp_interval = std::chrono::seconds{30},
+                 double max_rate = 0);
+
+    Rate_Unit unit() const { return unit_; }
+
+    // takes the packet's tokens and returns when it may be sent
+    time_point reserve(std::size_t msgs, std::size_t packet_len, time_point now);
+
+    // in the unit given, targets are per step
+    std::size_t step() const { return step_; }
+    double target() const { return rate_ / scale_; }
+    double achieved(time_point now) const;
+    double previous_target() const { return previous_rate_ / scale_; }
+    double previous_achieved() const { return previous_achieved_ / scale_; }
+
+    // metrics gauges, msgs/s, packets/s or bit/s
+    double target_per_second() const { return rate_; }
+    double achieved_per_second(time_point now) const { return achieved(now) * scale_; }
+
+  private:
+    double cost(std::size_t msgs, std::size_t packet_len) const;
+    void next_step();
+
+    Rate_Unit unit_;
+    double scale_; // internal units (bits for mbps) per unit given
+    double rate_;
+    double burst_;
+    double ramp_step_;
+    std::chrono::seconds ramp_interval_;
+    double max_rate_;
+
+    bool started_{false};
+    time_point full_at_{};
+    time_point step_start_{};
+    double step_units_{0};
+    std::size_t step_{0};
+    double previous_rate_{0};
+    double previous_achieved_{0};
+};
+
+#endif
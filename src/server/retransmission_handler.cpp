@@ -0,0 +1,223 @@
+#include "retransmission_handler.h"
+#include "itch.h"
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <system_error>
+
+Retransmission_Handler::Retransmission_Handler(std::string_view session,
+                                               Itch_File& itch_file,
+                                               Message_Buffer& msg_buffer,
+                                               const Message_Filter& filter,
+                                               Packet_Cache* packet_cache,
+                                               Retransmission_Metrics& metrics,
+                                               const Client_Limits& limits)
+    : session_header_{session},
+      itch_file_{itch_file},
+      msg_buffer_{msg_buffer},
+      packetizer_{itch_file, filter},
+      packet_cache_{packet_cache},
+      metrics_{metrics}
+{
+    if (limits.enabled())
+    {
+        throttle_.emplace(limits);
+    }
+}
+
+bool Retransmission_Handler::build_response(const void* datagram,
+                                            std::size_t len,
+                                            const sockaddr_in& client,
+                                            std::chrono::steady_clock::time_point now,
+                                            Retransmission_Response& res)
+{
+    metrics_.requests.add();
+
+    if (len != sizeof(mold_udp_64::Retransmission_Request))
+    {
+        metrics_.invalid_requests.add();
+        return false;
+    }
+
+    mold_udp_64::Retransmission_Request request;
+    std::memcpy(&request, datagram, sizeof(request));
+
+    if (request.session != session_header_.session)
+    {
+        metrics_.invalid_requests.add();
+        return false;
+    }
+
+    request.msg_count = ntohs(request.msg_count);
+
+    if (request.msg_count <= 0)
+    {
+        metrics_.invalid_requests.add();
+        return false;
+    }
+
+    auto seq{be64toh(request.sequence_num)};
+
+    if (throttle_)
+    {
+        switch (throttle_->admit(client, seq, request.msg_count, now))
+        {
+        case Client_Throttle::Verdict::throttled:
+            metrics_.throttled.add();
+            return false;
+        case Client_Throttle::Verdict::coalesced:
+            metrics_.coalesced.add();
+            return false;
+        case Client_Throttle::Verdict::send:
+            break;
+        }
+    }
+
+    if (!fill_response(request, seq, res))
+    {
+        return false;
+    }
+
+    if (throttle_)
+    {
+        throttle_->answered(seq, request.msg_count, now);
+    }
+    return true;
+}
+
+bool Retransmission_Handler::fill_response(const mold_udp_64::Retransmission_Request& request,
+                                           std::uint64_t seq,
+                                           Retransmission_Response& res)
+{
+    // a request from the start of a compiled packet is answered with that packet as the
+    // downstream sent it, nothing to walk or packetize
+    if (const auto* packet_file{msg_buffer_.packet_file()}; packet_file != nullptr)
+    {
+        if (const auto* packet{packet_file->find(seq)};
+            packet != nullptr && packet->seq_num == seq && packet->msg_count <= request.msg_count &&
+            sizeof(mold_udp_64::Downstream_Header) + packet->payload_len <= mold_udp_64::max_payload_size &&
+            packet->seq_num + packet->msg_count - 1 <= msg_buffer_.last_seq())
+        {
+            auto& res_ctx{res.res_ctx};
+            res_ctx.header.session = session_header_.session;
+            res_ctx.header.sequence_num = request.sequence_num;
+            res_ctx.header.msg_count = htons(static_cast<std::uint16_t>(packet->msg_count));
+            res_ctx.clear_payload();
+            res_ctx.append(packet->file_pos, packet->payload_len);
+            res.iov_len = res_ctx.fill_iov(res.iov.data(), itch_file_.at(0));
+            metrics_.buffer_hits.add();
+            return true;
+        }
+    }
+
+    if (packet_cache_ != nullptr)
+    {
+        if (const auto cached_len{packet_cache_->find(seq, request.msg_count, res.cached_packet)}; cached_len > 0)
+        {
+            res.iov[0] = {res.cached_packet.data(), cached_len};
+            res.iov_len = 1;
+            metrics_.cache_hits.add();
+            return true;
+        }
+        metrics_.cache_misses.add();
+    }
+
+    const auto file_pos{msg_buffer_.get_file_pos(seq)};
+
+    if (!file_pos)
+    {
+        metrics_.buffer_misses.add();
+        return false;
+    }
+    metrics_.buffer_hits.add();
+
+    auto& res_ctx{res.res_ctx};
+    res_ctx.header.session = session_header_.session;
+    res_ctx.header.sequence_num = request.sequence_num;
+    res_ctx.file_pos = *file_pos;
+    // only the first message is known to be validated, a truncated tail just ends the packet
+    packetizer_.fill(res_ctx, request.msg_count);
+    res_ctx.header.msg_count = htons(res_ctx.header.msg_count);
+
+    res.iov_len = res_ctx.fill_iov(res.iov.data(), itch_file_.at(0));
+
+    if (packet_cache_ != nullptr)
+    {
+        packet_cache_->insert(seq, request.msg_count, std::span{res.iov.data(), res.iov_len});
+    }
+    return true;
+}
+
+bool Retransmission_Handler::serves(const void* datagram, std::size_t len) const
+{
+    return len >= mold_udp_64::session_len &&
+           std::memcmp(datagram, session_header_.session.data(), mold_udp_64::session_len) == 0;
+}
+
+void bind_retransmission_socket(int fd, std::string_view address, std::uint16_t port)
+{
+    constexpr auto opt{1};
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+    {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+
+    if (const auto ret{inet_pton(AF_INET,
+                                 address.data(),
+                                 &addr.sin_addr)};
+        ret == 0)
+    {
+        throw std::invalid_argument(std::format("invalid ip format for request address {}", address));
+    }
+    else if (ret < 0)
+    {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+    {
+        throw std::system_error(errno, std::system_category());
+    }
+}
+
+Retransmission_Port::Retransmission_Port(std::string_view address, std::uint16_t port)
+    : sock{socket(AF_INET, SOCK_DGRAM, 0)}
+{
+    bind_retransmission_socket(sock.fd(), address, port);
+}
+
+std::deque<Retransmission_Port> bind_retransmission_ports(std::string_view address,
+                                                          const std::vector<Retransmission_Source>& sources,
+                                                          const std::vector<Retransmission_Metrics*>& metrics,
+                                                          const Client_Limits& limits)
+{
+    std::deque<Retransmission_Port> ports;
+    std::vector<std::uint16_t> port_nums;
+    for (std::size_t i = 0; i < sources.size(); ++i)
+    {
+        const auto& source{sources[i]};
+        auto it{std::ranges::find(port_nums, source.port)};
+        if (it == port_nums.end())
+        {
+            ports.emplace_back(address, source.port);
+            it = port_nums.insert(port_nums.end(), source.port);
+        }
+        ports[static_cast<std::size_t>(it - port_nums.begin())].handlers.emplace_back(source.session,
+                                                                                      source.itch_file,
+                                                                                      source.msg_buffer,
+                                                                                      source.filter,
+                                                                                      source.packet_cache,
+                                                                                      *metrics[i],
+                                                                                      limits);
+    }
+    return ports;
+}
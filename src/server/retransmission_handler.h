@@ -0,0 +1,136 @@
+#ifndef RETRANSMISSION_HANDLER_H
+#define RETRANSMISSION_HANDLER_H
+
+#include "client_throttle.h"
+#include "itch_file.h"
+#include "message_buffer.h"
+#include "message_filter.h"
+#include "metrics.h"
+#include "mold_udp_64.h"
+#include "packet_cache.h"
+#include "packetizer.h"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <netinet/in.h>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/uio.h>
+#include <vector>
+
+// one channel of one session as the retransmission workers see it, sources sharing a port
+// are told apart by the session in the request
+struct Retransmission_Source
+{
+    std::string session;
+    std::size_t channel;
+    std::uint16_t port;
+    Itch_File& itch_file;
+    Message_Buffer& msg_buffer;
+    const Message_Filter& filter;
+    Packet_Cache* packet_cache;
+};
+
+// a response is either a header plus slices of the mapping, or a whole packet copied
+// out of the packet cache; iov[0, iov_len) describes whichever it is
+struct Retransmission_Response
+{
+    mold_udp_64::Response_Context res_ctx;
+    std::array<std::byte, mold_udp_64::max_payload_size> cached_packet{};
+    std::array<iovec, mold_udp_64::max_packet_iovs> iov{};
+    std::size_t iov_len{0};
+
+    explicit Retransmission_Response(std::string_view session)
+        : res_ctx{session}
+    {
+    }
+
+    std::size_t len() const
+    {
+        std::size_t total{0};
+        for (std::size_t i = 0; i < iov_len; ++i)
+        {
+            total += iov[i].iov_len;
+        }
+        return total;
+    }
+};
+
+// request validation and response packetization shared by the retransmission worker engines
+class Retransmission_Handler
+{
+  public:
+    Retransmission_Handler(std::string_view session,
+                           Itch_File& itch_file,
+                           Message_Buffer& msg_buffer,
+                           const Message_Filter& filter,
+                           Packet_Cache* packet_cache,
+                           Retransmission_Metrics& metrics,
+                           const Client_Limits& limits = {});
+
+    // validates the datagram against the session, the client's limits and the message buffer
+    // and on success fills res with a response ready to send from res.iov
+    bool build_response(const void* datagram,
+                        std::size_t len,
+                        const sockaddr_in& client,
+                        std::chrono::steady_clock::time_point now,
+                        Retransmission_Response& res);
+
+    // the datagram is a request for this handler's session
+    bool serves(const void* datagram, std::size_t len) const;
+
+    Retransmission_Metrics& metrics() const { return metrics_; }
+
+  private:
+    bool fill_response(const mold_udp_64::Retransmission_Request& request,
+                       std::uint64_t seq,
+                       Retransmission_Response& res);
+
+    const mold_udp_64::Downstream_Header session_header_;
+    Itch_File& itch_file_;
+    Message_Buffer& msg_buffer_;
+    Packetizer packetizer_;
+    Packet_Cache* packet_cache_;
+    Retransmission_Metrics& metrics_;
+    std::optional<Client_Throttle> throttle_;
+};
+
+// SO_REUSEPORT so every worker binds its own socket and the kernel spreads clients across them
+void bind_retransmission_socket(int fd, std::string_view address, std::uint16_t port);
+
+// a worker's socket for one port and the handlers of the sessions sharing it
+struct Retransmission_Port
+{
+    jam_utils::FD sock;
+    std::vector<Retransmission_Handler> handlers;
+
+    Retransmission_Port(std::string_view address, std::uint16_t port);
+
+    // handler for the request's session, or the first to count it invalid
+    Retransmission_Handler& route(const void* datagram, std::size_t len)
+    {
+        if (handlers.size() > 1)
+        {
+            for (auto& handler : handlers)
+            {
+                if (handler.serves(datagram, len))
+                {
+                    return handler;
+                }
+            }
+        }
+        return handlers.front();
+    }
+};
+
+// one port per distinct port in sources, metrics[i] is the worker's metrics for sources[i]
+std::deque<Retransmission_Port> bind_retransmission_ports(std::string_view address,
+                                                          const std::vector<Retransmission_Source>& sources,
+                                                          const std::vector<Retransmission_Metrics*>& metrics,
+                                                          const Client_Limits& limits);
+
+#endif
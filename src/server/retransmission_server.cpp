@@ -1,23 +1,72 @@
 #include "retransmission_server.h"
 
 #include "retransmission_worker.h"
+#include "thread_placement.h"
+#ifdef WITH_IO_URING
+#include "retransmission_uring_worker.h"
+#endif
 
-Retransmission_Server::Retransmission_Server(std::string_view session,
-                                             std::string_view address,
-                                             std::uint16_t port,
-                                             jam_utils::M_Map& itch_file,
-                                             Message_Buffer& msg_buffer,
-                                             std::size_t num_threads)
+#include <format>
+#include <stdexcept>
+#include <utility>
+
+Retransmission_Server::Retransmission_Server(std::string_view address,
+                                             std::vector<Retransmission_Source> sources,
+                                             Metrics& metrics,
+                                             Retransmission_Engine engine,
+                                             std::size_t packet_cache_slots,
+                                             std::size_t num_threads,
+                                             const Client_Limits& client_limits,
+                                             std::vector<int> worker_cpus)
+    : sources_{std::move(sources)}
 {
+#ifndef WITH_IO_URING
+    if (engine == Retransmission_Engine::io_uring)
+    {
+        throw std::invalid_argument("io_uring retransmission engine not compiled, configure with -DWITH_IO_URING=On");
+    }
+#endif
+    if (sources_.empty())
+    {
+        throw std::invalid_argument("retransmission server needs at least one source");
+    }
+    for (std::size_t i = 0; i < sources_.size(); ++i)
+    {
+        for (std::size_t j = 0; j < i; ++j)
+        {
+            if (sources_[i].port == sources_[j].port && sources_[i].session == sources_[j].session)
+            {
+                throw std::invalid_argument(std::format("session {} used twice on retransmission port {}",
+                                                        sources_[i].session,
+                                                        sources_[i].port));
+            }
+        }
+        packet_caches_.push_back(packet_cache_slots > 0 ? std::make_unique<Packet_Cache>(packet_cache_slots) : nullptr);
+        sources_[i].packet_cache = packet_caches_.back().get();
+    }
+
     for (std::size_t i = 0; i < num_threads; ++i)
     {
-        worker_threads_.emplace_back([session, address, port, &itch_file, &msg_buffer, this] {
-            Retransmission_Worker worker{session,
-                                         address,
-                                         port,
-                                         shutdown_fd_,
-                                         itch_file,
-                                         msg_buffer};
+        std::vector<Retransmission_Metrics*> worker_metrics;
+        for (const auto& source : sources_)
+        {
+            worker_metrics.push_back(&metrics.add_retransmission(source.session, source.channel));
+        }
+        const auto cpu{worker_cpus.empty() ? -1 : worker_cpus[i % worker_cpus.size()]};
+        worker_threads_.emplace_back([address, worker_metrics{std::move(worker_metrics)}, engine, client_limits, cpu, this] {
+            if (cpu >= 0)
+            {
+                pin_thread({cpu});
+            }
+#ifdef WITH_IO_URING
+            if (engine == Retransmission_Engine::io_uring)
+            {
+                Retransmission_Uring_Worker worker{address, sources_, worker_metrics, client_limits, shutdown_fd_};
+                worker.start();
+                return;
+            }
+#endif
+            Retransmission_Worker worker{address, sources_, worker_metrics, client_limits, shutdown_fd_};
             worker.start();
         });
     }
@@ -1,28 +1,53 @@
 #ifndef RETRANSMISSION_SERVER_H
 #define RETRANSMISSION_SERVER_H
 
+#include "config.h"
+#include "itch_file.h"
 #include "message_buffer.h"
+#include "message_filter.h"
+#include "metrics.h"
+#include "packet_cache.h"
+#include "retransmission_handler.h"
 
-#include "jamutils/M_Map.h"
-
+#include <map>
+#include <memory>
+#include <string>
 #include <sys/eventfd.h>
 #include <vector>
 #include <thread>
 
+enum class Retransmission_Engine
+{
+    epoll,
+    io_uring
+};
+
+// for CLI11
+const std::map<std::string, Retransmission_Engine> retransmission_engine_map{{"epoll", Retransmission_Engine::epoll},
+                                                                              {"io_uring", Retransmission_Engine::io_uring}};
+
+// one pool of workers for every session and channel in the process, each worker serves
+// every source's port so the thread count follows the machine rather than the replays
 class Retransmission_Server
 {
   public:
-    Retransmission_Server(std::string_view session,
-                          std::string_view address,
-                          std::uint16_t port,
-                          jam_utils::M_Map& itch_file,
-                          Message_Buffer& msg_buffer,
-                          std::size_t num_threads = std::thread::hardware_concurrency() - 1);
+    // sources' packet caches are created here, sources sharing a port need distinct sessions.
+    // Worker i is pinned to worker_cpus[i % size], empty leaves them unpinned
+    Retransmission_Server(std::string_view address,
+                          std::vector<Retransmission_Source> sources,
+                          Metrics& metrics,
+                          Retransmission_Engine engine = Retransmission_Engine::epoll,
+                          std::size_t packet_cache_slots = config::packet_cache_slots,
+                          std::size_t num_threads = std::thread::hardware_concurrency() - 1,
+                          const Client_Limits& client_limits = {},
+                          std::vector<int> worker_cpus = {});
 
     void stop() const;
 
   private:
     const int shutdown_fd_{eventfd(0, EFD_CLOEXEC)};
+    std::vector<std::unique_ptr<Packet_Cache>> packet_caches_;
+    std::vector<Retransmission_Source> sources_;
     std::vector<std::jthread> worker_threads_;
 };
 
@@ -0,0 +1,266 @@
+#include "retransmission_uring_worker.h"
+#include "config.h"
+#include "mold_udp_64.h"
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <print>
+
+namespace
+{
+constexpr std::uint64_t op_shift{32};
+constexpr std::uint64_t index_mask{(std::uint64_t{1} << op_shift) - 1};
+constexpr int buf_group{0};
+} // namespace
+
+Retransmission_Uring_Worker::Retransmission_Uring_Worker(std::string_view address,
+                                                         const std::vector<Retransmission_Source>& sources,
+                                                         const std::vector<Retransmission_Metrics*>& metrics,
+                                                         const Client_Limits& limits,
+                                                         int shutdown_fd)
+    : ports_{bind_retransmission_ports(address, sources, metrics, limits)},
+      shutdown_fd_{shutdown_fd},
+      recv_buffs_(std::size_t{config::uring_recv_buffers} * config::uring_recv_buffer_size),
+      send_slots_(config::uring_send_slots, Send_Slot{sources.front().session})
+{
+    // COOP_TASKRUN saves an IPI per completion but needs 5.19, fall back to default setup
+    if (io_uring_queue_init(config::uring_entries, &ring_, IORING_SETUP_COOP_TASKRUN) < 0)
+    {
+        if (const int ret{io_uring_queue_init(config::uring_entries, &ring_, 0)}; ret < 0)
+        {
+            throw std::system_error(-ret, std::system_category(), "io_uring_queue_init");
+        }
+    }
+
+    int ret{};
+    buf_ring_ = io_uring_setup_buf_ring(&ring_, config::uring_recv_buffers, buf_group, 0, &ret);
+    if (buf_ring_ == nullptr)
+    {
+        io_uring_queue_exit(&ring_);
+        throw std::system_error(-ret, std::system_category(), "io_uring_setup_buf_ring");
+    }
+    for (std::uint16_t buf_id = 0; buf_id < config::uring_recv_buffers; ++buf_id)
+    {
+        recycle_buffer(buf_id);
+    }
+    io_uring_buf_ring_advance(buf_ring_, recycled_);
+    recycled_ = 0;
+
+    recv_msg_.msg_namelen = sizeof(sockaddr_in);
+
+    free_slots_.reserve(send_slots_.size());
+    for (std::size_t i = 0; i < send_slots_.size(); ++i)
+    {
+        auto& slot{send_slots_[i]};
+        slot.msg.msg_name = &slot.client_addr;
+        slot.msg.msg_namelen = sizeof(slot.client_addr);
+        slot.msg.msg_iov = slot.res.iov.data();
+        free_slots_.push_back(static_cast<std::uint32_t>(i));
+    }
+}
+
+Retransmission_Uring_Worker::~Retransmission_Uring_Worker()
+{
+    io_uring_free_buf_ring(&ring_, buf_ring_, config::uring_recv_buffers, buf_group);
+    io_uring_queue_exit(&ring_);
+}
+
+void Retransmission_Uring_Worker::start()
+{
+    for (std::uint32_t port_idx = 0; port_idx < ports_.size(); ++port_idx)
+    {
+        arm_recv(port_idx);
+    }
+    arm_shutdown();
+
+    std::array<io_uring_cqe*, config::uring_cqe_batch> cqes{};
+    while (!stopping_ || in_flight_ > 0)
+    {
+        // sends queued while handling the previous batch go out with this submit
+        if (const int ret{io_uring_submit_and_wait(&ring_, 1)}; ret < 0)
+        {
+            if (ret == -EINTR || ret == -EAGAIN)
+            {
+                continue;
+            }
+            throw std::system_error(-ret, std::system_category(), "io_uring_submit_and_wait");
+        }
+
+        const unsigned count{io_uring_peek_batch_cqe(&ring_, cqes.data(), cqes.size())};
+        for (unsigned i = 0; i < count; ++i)
+        {
+            const io_uring_cqe& cqe{*cqes[i]};
+            const auto user_data{io_uring_cqe_get_data64(&cqe)};
+
+            switch (static_cast<Op>(user_data >> op_shift))
+            {
+            case Op::recv:
+            {
+                const auto port_idx{static_cast<std::uint32_t>(user_data & index_mask)};
+                handle_recv(cqe, port_idx);
+                // multishot recv stops on error (e.g. ENOBUFS when every buffer is in use) or cancellation
+                if ((cqe.flags & IORING_CQE_F_MORE) == 0)
+                {
+                    --in_flight_;
+                    if (!stopping_)
+                    {
+                        arm_recv(port_idx);
+                    }
+                }
+                break;
+            }
+            case Op::send:
+                --in_flight_;
+                handle_send(cqe, static_cast<std::uint32_t>(user_data & index_mask));
+                break;
+            case Op::shutdown:
+                --in_flight_;
+                stopping_ = true;
+                cancel_recvs();
+                break;
+            case Op::cancel:
+                --in_flight_;
+                break;
+            }
+        }
+        io_uring_cq_advance(&ring_, count);
+
+        io_uring_buf_ring_advance(buf_ring_, recycled_);
+        recycled_ = 0;
+    }
+}
+
+io_uring_sqe* Retransmission_Uring_Worker::get_sqe()
+{
+    auto* sqe{io_uring_get_sqe(&ring_)};
+    if (sqe == nullptr)
+    {
+        // submission queue full, flush what we have and take the freed entry
+        io_uring_submit(&ring_);
+        sqe = io_uring_get_sqe(&ring_);
+    }
+    return sqe;
+}
+
+void Retransmission_Uring_Worker::arm_recv(std::uint32_t port_idx)
+{
+    auto* sqe{get_sqe()};
+    io_uring_prep_recvmsg_multishot(sqe, ports_[port_idx].sock.fd(), &recv_msg_, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = buf_group;
+    io_uring_sqe_set_data64(sqe, (static_cast<std::uint64_t>(Op::recv) << op_shift) | port_idx);
+    ++in_flight_;
+}
+
+void Retransmission_Uring_Worker::arm_shutdown()
+{
+    // poll rather than read so the eventfd count is left for the other workers
+    auto* sqe{get_sqe()};
+    io_uring_prep_poll_add(sqe, shutdown_fd_, POLLIN);
+    io_uring_sqe_set_data64(sqe, static_cast<std::uint64_t>(Op::shutdown) << op_shift);
+    ++in_flight_;
+}
+
+// each recv then completes without IORING_CQE_F_MORE, sends already queued are left to finish
+void Retransmission_Uring_Worker::cancel_recvs()
+{
+    for (std::uint32_t port_idx = 0; port_idx < ports_.size(); ++port_idx)
+    {
+        auto* sqe{get_sqe()};
+        io_uring_prep_cancel64(sqe, (static_cast<std::uint64_t>(Op::recv) << op_shift) | port_idx, 0);
+        io_uring_sqe_set_data64(sqe, static_cast<std::uint64_t>(Op::cancel) << op_shift);
+        ++in_flight_;
+    }
+}
+
+void Retransmission_Uring_Worker::handle_recv(const io_uring_cqe& cqe, std::uint32_t port_idx)
+{
+    if (cqe.res < 0)
+    {
+        if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED)
+        {
+            std::println(std::cerr, "recvmsg: {}", std::strerror(-cqe.res));
+        }
+        return;
+    }
+    if ((cqe.flags & IORING_CQE_F_BUFFER) == 0)
+    {
+        return;
+    }
+
+    const auto buf_id{static_cast<std::uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT)};
+    auto* buf{&recv_buffs_[std::size_t{buf_id} * config::uring_recv_buffer_size]};
+
+    auto* out{io_uring_recvmsg_validate(buf, cqe.res, &recv_msg_)};
+    if (out == nullptr)
+    {
+        recycle_buffer(buf_id);
+        return;
+    }
+
+    auto& port{ports_[port_idx]};
+    auto* payload{io_uring_recvmsg_payload(out, &recv_msg_)};
+    const auto payload_len{io_uring_recvmsg_payload_length(out, cqe.res, &recv_msg_)};
+    auto& handler{port.route(payload, payload_len)};
+    if (free_slots_.empty())
+    {
+        handler.metrics().dropped.add();
+    }
+    else if ((out->flags & MSG_TRUNC) == 0 && out->namelen == sizeof(sockaddr_in))
+    {
+        auto& slot{send_slots_[free_slots_.back()]};
+        std::memcpy(&slot.client_addr, io_uring_recvmsg_name(out), sizeof(slot.client_addr));
+        slot.received_at = std::chrono::steady_clock::now();
+        if (handler.build_response(payload, payload_len, slot.client_addr, slot.received_at, slot.res))
+        {
+#ifndef DEBUG_NO_NETWORK
+            slot.msg.msg_iovlen = slot.res.iov_len;
+            slot.metrics = &handler.metrics();
+
+            auto* sqe{get_sqe()};
+            io_uring_prep_sendmsg(sqe, port.sock.fd(), &slot.msg, 0);
+            io_uring_sqe_set_data64(sqe, (static_cast<std::uint64_t>(Op::send) << op_shift) | free_slots_.back());
+            free_slots_.pop_back();
+            ++in_flight_;
+#endif
+        }
+    }
+
+    recycle_buffer(buf_id);
+}
+
+void Retransmission_Uring_Worker::handle_send(const io_uring_cqe& cqe, std::uint32_t slot_idx)
+{
+    const auto& slot{send_slots_[slot_idx]};
+    if (cqe.res < 0)
+    {
+        std::println(std::cerr, "sendmsg: {}", std::strerror(-cqe.res));
+        slot.metrics->dropped.add();
+    }
+    else
+    {
+        if (const auto packet_len{slot.res.len()}; static_cast<std::size_t>(cqe.res) != packet_len)
+        {
+            std::println(std::cerr, "sendmsg sent only {} of {} bytes", cqe.res, packet_len);
+        }
+        slot.metrics->responses_sent.add();
+        slot.metrics->bytes_sent.add(static_cast<std::uint64_t>(cqe.res));
+        slot.metrics->response_latency.record(std::chrono::steady_clock::now() - slot.received_at);
+    }
+    free_slots_.push_back(slot_idx);
+}
+
+void Retransmission_Uring_Worker::recycle_buffer(std::uint16_t buf_id)
+{
+    io_uring_buf_ring_add(buf_ring_,
+                          &recv_buffs_[std::size_t{buf_id} * config::uring_recv_buffer_size],
+                          config::uring_recv_buffer_size,
+                          buf_id,
+                          io_uring_buf_ring_mask(config::uring_recv_buffers),
+                          recycled_++);
+}
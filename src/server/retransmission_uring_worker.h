@@ -0,0 +1,86 @@
+#ifndef RETRANSMISSION_URING_WORKER_H
+#define RETRANSMISSION_URING_WORKER_H
+
+#include "itch_file.h"
+#include "message_buffer.h"
+#include "packet_cache.h"
+#include "retransmission_handler.h"
+
+#include "mold_udp_64.h"
+
+#include <liburing.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <netinet/in.h>
+#include <vector>
+
+// io_uring alternative to Retransmission_Worker: a multishot recvmsg feeding a provided buffer
+// ring, with all responses from one batch of completions submitted in a single io_uring_enter
+class Retransmission_Uring_Worker
+{
+  public:
+    // metrics[i] is this worker's metrics for sources[i]
+    Retransmission_Uring_Worker(std::string_view address,
+                                const std::vector<Retransmission_Source>& sources,
+                                const std::vector<Retransmission_Metrics*>& metrics,
+                                const Client_Limits& limits,
+                                int shutdown_fd);
+    ~Retransmission_Uring_Worker();
+
+    Retransmission_Uring_Worker(const Retransmission_Uring_Worker&) = delete;
+    Retransmission_Uring_Worker& operator=(const Retransmission_Uring_Worker&) = delete;
+
+    void start();
+
+  private:
+    enum class Op : std::uint64_t
+    {
+        recv,
+        send,
+        shutdown,
+        cancel
+    };
+
+    io_uring_sqe* get_sqe();
+    void arm_recv(std::uint32_t port_idx);
+    void arm_shutdown();
+    void cancel_recvs();
+    void handle_recv(const io_uring_cqe& cqe, std::uint32_t port_idx);
+    void handle_send(const io_uring_cqe& cqe, std::uint32_t slot_idx);
+    void recycle_buffer(std::uint16_t buf_id);
+
+    struct Send_Slot
+    {
+        Retransmission_Response res;
+        sockaddr_in client_addr{};
+        msghdr msg{};
+        std::chrono::steady_clock::time_point received_at;
+        Retransmission_Metrics* metrics{};
+        explicit Send_Slot(std::string_view session)
+            : res{session}
+        {
+        }
+    };
+
+    std::deque<Retransmission_Port> ports_;
+    const int shutdown_fd_;
+
+    io_uring ring_{};
+    io_uring_buf_ring* buf_ring_{};
+    std::vector<std::byte> recv_buffs_;
+    std::uint16_t recycled_{};
+    msghdr recv_msg_{};
+
+    std::vector<Send_Slot> send_slots_;
+    std::vector<std::uint32_t> free_slots_;
+
+    // requests the kernel still holds, on shutdown start() returns only once they have all
+    // completed since they point into the slots and buffers
+    std::size_t in_flight_{0};
+    bool stopping_{false};
+};
+
+#endif
@@ -1,64 +1,53 @@
 #include "retransmission_worker.h"
 #include "config.h"
-#include "itch.h"
 #include "mold_udp_64.h"
 
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <chrono>
 #include <cstdio>
 #include <iostream>
 #include <print>
 
-Retransmission_Worker::Retransmission_Worker(std::string_view session,
-                                             std::string_view address,
-                                             std::uint16_t port,
-                                             int shutdown_fd,
-                                             jam_utils::M_Map& itch_file,
-                                             Message_Buffer& msg_buffer)
-    : res_ctx_{session},
+namespace
+{
+// epoll data for the shutdown eventfd, the sockets' is their index in ports_
+constexpr std::uint64_t shutdown_event{UINT64_MAX};
+} // namespace
+
+Retransmission_Worker::Retransmission_Worker(std::string_view address,
+                                             const std::vector<Retransmission_Source>& sources,
+                                             const std::vector<Retransmission_Metrics*>& metrics,
+                                             const Client_Limits& limits,
+                                             int shutdown_fd)
+    : ports_{bind_retransmission_ports(address, sources, metrics, limits)},
       shutdown_fd_{shutdown_fd},
-      itch_file_{itch_file},
-      msg_buffer_{msg_buffer},
-      sock_{socket(AF_INET, SOCK_DGRAM, 0)},
-      epoll_fd_{epoll_create1(0)}
+      epoll_fd_{epoll_create1(0)},
+      responses_(config::retrans_batch_size, Retransmission_Response{sources.front().session})
 {
-    constexpr auto opt{1};
-    if (setsockopt(sock_.fd(), SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0 ||
-        setsockopt(sock_.fd(), SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+    for (std::size_t i = 0; i < config::retrans_batch_size; ++i)
     {
-        throw std::system_error(errno, std::system_category());
-    }
-
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
+        req_ctxs_[i].iov = {&req_ctxs_[i].request, sizeof(mold_udp_64::Retransmission_Request)};
+        recv_msgs_[i].msg_hdr.msg_iov = &req_ctxs_[i].iov;
+        recv_msgs_[i].msg_hdr.msg_iovlen = 1;
+        recv_msgs_[i].msg_hdr.msg_name = &req_ctxs_[i].client_addr;
 
-    if (const auto ret{inet_pton(AF_INET,
-                                 address.data(),
-                                 &addr.sin_addr)};
-        ret == 0)
-    {
-        throw std::invalid_argument(std::format("invalid ip format for request address {}", address));
-    }
-    else if (ret < 0)
-    {
-        throw std::system_error(errno, std::system_category());
-    }
-
-    if (bind(sock_.fd(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
-    {
-        throw std::system_error(errno, std::system_category());
+        send_msgs_[i].msg_hdr.msg_iov = responses_[i].iov.data();
+        send_msgs_[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
     }
 
     event_.events = EPOLLIN | EPOLLET;
-    event_.data.fd = sock_.fd();
-
-    if (epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_ADD, sock_.fd(), &event_) < 0)
+    for (std::size_t i = 0; i < ports_.size(); ++i)
     {
-        throw std::system_error(errno, std::system_category());
+        event_.data.u64 = i;
+        if (epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_ADD, ports_[i].sock.fd(), &event_) < 0)
+        {
+            throw std::system_error(errno, std::system_category());
+        }
     }
 
-    event_.data.fd = shutdown_fd_;
+    event_.data.u64 = shutdown_event;
 
     if (epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_ADD, shutdown_fd_, &event_) < 0)
     {
@@ -83,136 +72,104 @@ void Retransmission_Worker::start()
         for (std::size_t i = 0; i < static_cast<std::size_t>(nfds); ++i)
         {
             const epoll_event& ev{events_[i]};
-            const int client_fd{ev.data.fd};
 
-            if (client_fd == shutdown_fd_)
+            if (ev.data.u64 == shutdown_event)
             {
                 return;
             }
 
             if ((ev.events & EPOLLIN) != 0)
             {
-                while (try_parse_request(client_fd))
+                auto& port{ports_[ev.data.u64]};
+                // a short batch means the socket is drained, later datagrams raise a new edge
+                std::size_t num_requests{};
+                do
                 {
-                    fill_response_buffer();
-                    send_response();
-                }
+                    num_requests = receive_requests(port.sock.fd());
+                    send_responses(port, num_requests);
+                } while (num_requests == config::retrans_batch_size);
             }
         }
     }
 }
 
-bool Retransmission_Worker::try_parse_request(int client_fd)
+std::size_t Retransmission_Worker::receive_requests(int client_fd)
 {
-    const ssize_t bytes_recv{
-        recvfrom(client_fd,
-                 &req_ctx_.request,
-                 sizeof(mold_udp_64::Retransmission_Request),
-                 0,
-                 reinterpret_cast<sockaddr*>(&req_ctx_.client_addr),
-                 &addr_len_)};
-
-    if (bytes_recv < 0)
+    for (auto& msg : recv_msgs_)
     {
-        if (errno == EWOULDBLOCK)
-        {
-            return false;
-        }
-        std::perror("recvfrom");
-        return false;
+        msg.msg_hdr.msg_namelen = sizeof(sockaddr_in);
     }
-    else if (static_cast<std::size_t>(bytes_recv) != sizeof(mold_udp_64::Retransmission_Request))
-    {
-        return false;
-    }
-
-    if (req_ctx_.request.session != res_ctx_.header.session)
-    {
-        return false;
-    }
-
-    req_ctx_.request.msg_count = ntohs(req_ctx_.request.msg_count);
 
-    if (req_ctx_.request.msg_count <= 0)
+    const int received{recvmmsg(client_fd,
+                                recv_msgs_.data(),
+                                config::retrans_batch_size,
+                                MSG_DONTWAIT,
+                                nullptr)};
+    if (received < 0)
     {
-        return false;
-    }
-
-    const auto file_pos{msg_buffer_.get_file_pos(be64toh(req_ctx_.request.sequence_num))};
-
-    if (!file_pos)
-    {
-        return false;
+        if (errno != EWOULDBLOCK)
+        {
+            std::perror("recvmmsg");
+        }
+        return 0;
     }
-
-    res_ctx_.file_pos = *file_pos;
-    return true;
+    return static_cast<std::size_t>(received);
 }
 
-void Retransmission_Worker::fill_response_buffer()
+void Retransmission_Worker::send_responses(Retransmission_Port& port, std::size_t num_requests)
 {
-    res_ctx_.header.msg_count = 0;
-    res_ctx_.header.sequence_num = req_ctx_.request.sequence_num;
-
-    res_ctx_.buff_len = sizeof(mold_udp_64::Downstream_Header);
-
-    while (res_ctx_.buff_len < mold_udp_64::max_payload_size &&
-           res_ctx_.file_pos < itch_file_.len() &&
-           res_ctx_.header.msg_count < req_ctx_.request.msg_count)
+    const auto received_at{std::chrono::steady_clock::now()};
+    std::size_t num_responses{0};
+    for (std::size_t i = 0; i < num_requests; ++i)
     {
-        if (res_ctx_.file_pos + itch::len_prefix_size > itch_file_.len())
-        {
-            break;
-        }
-
-        std::uint16_t len_prefix;
-        std::memcpy(&len_prefix,
-                    itch_file_.at(res_ctx_.file_pos),
-                    itch::len_prefix_size);
-        len_prefix = ntohs(len_prefix);
-
-        const std::size_t total_msg_len{itch::len_prefix_size + len_prefix};
-
-        if (res_ctx_.buff_len + total_msg_len > mold_udp_64::max_payload_size)
+        auto& handler{port.route(&req_ctxs_[i].request, recv_msgs_[i].msg_len)};
+        if ((recv_msgs_[i].msg_hdr.msg_flags & MSG_TRUNC) != 0 ||
+            !handler.build_response(&req_ctxs_[i].request,
+                                    recv_msgs_[i].msg_len,
+                                    req_ctxs_[i].client_addr,
+                                    received_at,
+                                    responses_[num_responses]))
         {
-            break;
+            continue;
         }
 
-        std::memcpy(&res_ctx_.buff[res_ctx_.buff_len],
-                    itch_file_.at(res_ctx_.file_pos),
-                    total_msg_len);
-
-        res_ctx_.buff_len += total_msg_len;
-        res_ctx_.file_pos += total_msg_len;
-        ++res_ctx_.header.msg_count;
+        response_metrics_[num_responses] = &handler.metrics();
+        send_msgs_[num_responses].msg_hdr.msg_name = &req_ctxs_[i].client_addr;
+        send_msgs_[num_responses].msg_hdr.msg_iovlen = responses_[num_responses].iov_len;
+        ++num_responses;
     }
-}
-
-void Retransmission_Worker::send_response()
-{
-    res_ctx_.header.msg_count = htons(res_ctx_.header.msg_count);
-    std::memcpy(res_ctx_.buff.data(),
-                &res_ctx_.header,
-                sizeof(mold_udp_64::Downstream_Header));
 
 #ifndef DEBUG_NO_NETWORK
-    if (const ssize_t bytes_sent{
-            sendto(sock_.fd(),
-                   res_ctx_.buff.data(),
-                   res_ctx_.buff_len,
-                   0,
-                   reinterpret_cast<sockaddr*>(&req_ctx_.client_addr),
-                   sizeof(req_ctx_.client_addr))};
-        bytes_sent < 0)
-    {
-        std::perror("sendto");
-    }
-    else if (bytes_sent != static_cast<ssize_t>(res_ctx_.buff_len))
+    std::size_t sent{0};
+    while (sent < num_responses)
     {
-        std::println(std::cerr,
-                     "sendto sent only {} of {} bytes",
-                     bytes_sent,
-                     res_ctx_.buff_len);
+        const int ret{sendmmsg(port.sock.fd(),
+                               &send_msgs_[sent],
+                               static_cast<unsigned int>(num_responses - sent),
+                               0)};
+        if (ret < 0)
+        {
+            // skip the response which failed rather than dropping the other clients' responses
+            std::perror("sendmmsg");
+            response_metrics_[sent]->dropped.add();
+            ++sent;
+            continue;
+        }
+        const auto latency{std::chrono::steady_clock::now() - received_at};
+        for (std::size_t i = sent; i < sent + static_cast<std::size_t>(ret); ++i)
+        {
+            if (const auto packet_len{responses_[i].len()}; send_msgs_[i].msg_len != packet_len)
+            {
+                std::println(std::cerr,
+                             "sendmmsg sent only {} of {} bytes",
+                             send_msgs_[i].msg_len,
+                             packet_len);
+            }
+            response_metrics_[i]->bytes_sent.add(send_msgs_[i].msg_len);
+            response_metrics_[i]->response_latency.record(latency);
+            response_metrics_[i]->responses_sent.add();
+        }
+        sent += static_cast<std::size_t>(ret);
     }
 #endif
 }
@@ -1,55 +1,58 @@
 #ifndef RETRANSMISSION_WORKER_H
 #define RETRANSMISSION_WORKER_H
 
+#include "itch_file.h"
 #include "message_buffer.h"
+#include "packet_cache.h"
+#include "retransmission_handler.h"
 
 #include "config.h"
 #include "mold_udp_64.h"
 
-#include <jamutils/M_Map.h>
-
+#include <array>
 #include <cstdint>
+#include <deque>
+#include <vector>
 #include <sys/epoll.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
 
 class Retransmission_Worker
 {
   public:
-    Retransmission_Worker(std::string_view session,
-                          std::string_view address,
-                          std::uint16_t port,
-                          int shutdown_fd,
-                          jam_utils::M_Map& itch_file,
-                          Message_Buffer& msg_buffer);
+    // metrics[i] is this worker's metrics for sources[i]
+    Retransmission_Worker(std::string_view address,
+                          const std::vector<Retransmission_Source>& sources,
+                          const std::vector<Retransmission_Metrics*>& metrics,
+                          const Client_Limits& limits,
+                          int shutdown_fd);
 
     void start();
 
   private:
-    bool try_parse_request(int client_fd);
-
-    void fill_response_buffer();
+    std::size_t receive_requests(int client_fd);
 
-    void send_response();
+    void send_responses(Retransmission_Port& port, std::size_t num_requests);
 
-    mold_udp_64::Response_Context res_ctx_;
+    std::deque<Retransmission_Port> ports_;
     const int shutdown_fd_;
-    jam_utils::M_Map& itch_file_;
-    Message_Buffer& msg_buffer_;
 
-    jam_utils::FD sock_;
     jam_utils::FD epoll_fd_;
     epoll_event event_{};
     std::array<epoll_event, config::epoll_max_events> events_{};
-    sockaddr_in addr_{};
-    socklen_t addr_len_{sizeof(addr_)};
 
     struct Request_Context
     {
         mold_udp_64::Retransmission_Request request;
         sockaddr_in client_addr;
+        iovec iov;
     };
-    Request_Context req_ctx_{};
-    std::array<std::byte, sizeof(mold_udp_64::Retransmission_Request)> req_buff_{};
+    std::array<Request_Context, config::retrans_batch_size> req_ctxs_{};
+    std::array<mmsghdr, config::retrans_batch_size> recv_msgs_{};
+
+    std::vector<Retransmission_Response> responses_;
+    std::array<Retransmission_Metrics*, config::retrans_batch_size> response_metrics_{};
+    std::array<mmsghdr, config::retrans_batch_size> send_msgs_{};
 };
 
 #endif
@@ -0,0 +1,248 @@
+#include "session_index.h"
+#include "config.h"
+#include "itch.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <print>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+constexpr std::size_t npos{static_cast<std::size_t>(-1)};
+// consecutive well formed messages required before a chunk is considered synchronised
+constexpr std::size_t sync_chain_len{64};
+
+bool is_msg_chain(const Itch_File& itch_file, std::size_t pos)
+{
+    for (std::size_t i = 0; i < sync_chain_len && pos < itch_file.len(); ++i)
+    {
+        if (pos + itch::len_prefix_size + 1 > itch_file.len())
+        {
+            return false;
+        }
+        const auto len{itch::extract_len(itch_file.at(pos))};
+        const auto type{std::to_integer<std::uint8_t>(*itch_file.at(pos + itch::msg_type_offset))};
+        if (len == 0 || itch::msg_len_by_type[type] != len)
+        {
+            return false;
+        }
+        pos += itch::len_prefix_size + len;
+    }
+    return pos <= itch_file.len();
+}
+
+// ITCH has no sync marker so find the first offset in [begin, end) that starts a chain of
+// messages whose length prefixes agree with their types
+std::size_t find_sync(const Itch_File& itch_file, std::size_t begin, std::size_t end)
+{
+    for (std::size_t pos = begin; pos < end; ++pos)
+    {
+        if (is_msg_chain(itch_file, pos))
+        {
+            return pos;
+        }
+    }
+    return npos;
+}
+
+struct Chunk
+{
+    std::size_t begin{npos};
+    std::size_t end{};
+    std::uint64_t msg_count{};
+    std::vector<Session_Index::Checkpoint> checkpoints; // seq_num relative to the chunk
+};
+
+// walk [chunk.begin, limit) by length prefix, returns the offset the walk stopped at
+std::size_t walk_chunk(const Itch_File& itch_file, Chunk& chunk, std::size_t limit)
+{
+    auto pos{chunk.begin};
+    while (pos < limit)
+    {
+        if (pos + itch::len_prefix_size > itch_file.len())
+        {
+            throw std::runtime_error("unexpected trailing bytes at eof");
+        }
+
+        const std::size_t total_msg_len{itch::len_prefix_size + itch::extract_len(itch_file.at(pos))};
+
+        if (pos + total_msg_len > itch_file.len())
+        {
+            throw std::runtime_error("ITCH message exceeds file size");
+        }
+
+        if (chunk.msg_count % config::index_checkpoint_interval == 0)
+        {
+            chunk.checkpoints.push_back({pos, chunk.msg_count, itch::extract_timestamp(itch_file.at(pos))});
+        }
+
+        pos += total_msg_len;
+        ++chunk.msg_count;
+    }
+    return pos;
+}
+} // namespace
+
+std::filesystem::path Session_Index::sidecar_path(const std::filesystem::path& itch_file_path)
+{
+    auto path{itch_file_path};
+    path += ".idx";
+    return path;
+}
+
+void Session_Index::build(const std::filesystem::path& itch_file_path,
+                          const Itch_File& itch_file,
+                          std::size_t num_threads)
+{
+    num_threads = std::max<std::size_t>(num_threads, 1);
+    const auto chunk_size{std::max<std::size_t>(itch_file.len() / num_threads, 1)};
+
+    std::vector<Chunk> chunks(num_threads);
+    chunks[0].begin = 0;
+    {
+        std::vector<std::jthread> threads;
+        for (std::size_t i = 1; i < num_threads; ++i)
+        {
+            threads.emplace_back([&, i] {
+                chunks[i].begin = find_sync(itch_file,
+                                            std::min(i * chunk_size, itch_file.len()),
+                                            std::min((i + 1) * chunk_size, itch_file.len()));
+            });
+        }
+    }
+
+    // chunks which failed to sync are absorbed by the previous one
+    std::erase_if(chunks, [](const Chunk& chunk) { return chunk.begin == npos; });
+    for (std::size_t i = 0; i < chunks.size(); ++i)
+    {
+        chunks[i].end = i + 1 < chunks.size() ? chunks[i + 1].begin : itch_file.len();
+    }
+
+    std::vector<std::size_t> walk_ends(chunks.size());
+    {
+        std::vector<std::jthread> threads;
+        for (std::size_t i = 0; i < chunks.size(); ++i)
+        {
+            threads.emplace_back([&, i] {
+                try
+                {
+                    walk_ends[i] = walk_chunk(itch_file, chunks[i], chunks[i].end);
+                }
+                catch (const std::runtime_error&)
+                {
+                    walk_ends[i] = npos; // serial rebuild reports the error if it is real
+                }
+            });
+        }
+    }
+
+    // a false sync shows up as a walk overshooting the next chunk start, redo it serially
+    for (std::size_t i = 0; i < chunks.size(); ++i)
+    {
+        if (walk_ends[i] != chunks[i].end)
+        {
+            std::println("Index chunk {} did not line up, rebuilding serially", i);
+            chunks.resize(1);
+            chunks[0] = Chunk{.begin = 0, .end = itch_file.len(), .msg_count = 0, .checkpoints = {}};
+            walk_chunk(itch_file, chunks[0], itch_file.len());
+            break;
+        }
+    }
+
+    Header header{.magic = magic,
+                  .itch_file_len = itch_file.len(),
+                  .itch_file_mtime = Itch_File::mtime(itch_file_path),
+                  .checkpoint_interval = config::index_checkpoint_interval,
+                  .checkpoint_count = 0,
+                  .msg_count = 0};
+
+    std::vector<Checkpoint> checkpoints;
+    for (const auto& chunk : chunks)
+    {
+        for (auto checkpoint : chunk.checkpoints)
+        {
+            checkpoint.seq_num += header.msg_count + 1;
+            checkpoints.push_back(checkpoint);
+        }
+        header.msg_count += chunk.msg_count;
+    }
+    header.checkpoint_count = checkpoints.size();
+
+    const auto path{sidecar_path(itch_file_path)};
+    auto tmp_path{path};
+    tmp_path += ".tmp";
+    {
+        std::ofstream out{tmp_path, std::ios::binary | std::ios::trunc};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(checkpoints.data()),
+                  static_cast<std::streamsize>(checkpoints.size() * sizeof(Checkpoint)));
+        if (!out)
+        {
+            throw std::runtime_error(std::format("failed writing index {}", tmp_path.string()));
+        }
+    }
+    std::filesystem::rename(tmp_path, path);
+}
+
+bool Session_Index::is_current(const std::filesystem::path& itch_file_path,
+                               const Itch_File& itch_file)
+{
+    std::ifstream in{sidecar_path(itch_file_path), std::ios::binary};
+    Header header{};
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)))
+    {
+        return false;
+    }
+    return header.magic == magic &&
+           header.itch_file_len == itch_file.len() &&
+           header.itch_file_mtime == Itch_File::mtime(itch_file_path) &&
+           header.checkpoint_interval == config::index_checkpoint_interval;
+}
+
+Session_Index::Session_Index(const std::filesystem::path& itch_file_path)
+    : sidecar_{sidecar_path(itch_file_path), PROT_READ, MAP_PRIVATE, 0},
+      header_{reinterpret_cast<const Header*>(sidecar_.at(0))}
+{
+    if (sidecar_.len() < sizeof(Header) || header_->magic != magic ||
+        sidecar_.len() != sizeof(Header) + header_->checkpoint_count * sizeof(Checkpoint))
+    {
+        throw std::runtime_error(std::format("malformed index {}", sidecar_path(itch_file_path).string()));
+    }
+    if (header_->checkpoint_count > 0)
+    {
+        checkpoints_ = {reinterpret_cast<const Checkpoint*>(sidecar_.at(sizeof(Header))),
+                        header_->checkpoint_count};
+    }
+}
+
+Session_Index::Checkpoint Session_Index::seek(std::chrono::nanoseconds timestamp) const
+{
+    const auto it{std::ranges::partition_point(checkpoints_, [timestamp](const Checkpoint& checkpoint) {
+        return checkpoint.timestamp < static_cast<std::uint64_t>(timestamp.count());
+    })};
+    if (it == checkpoints_.begin())
+    {
+        return {0, 1, 0};
+    }
+    return *std::prev(it);
+}
+
+Session_Index::Checkpoint Session_Index::checkpoint_before(std::uint64_t seq) const
+{
+    const auto it{std::ranges::partition_point(checkpoints_, [seq](const Checkpoint& checkpoint) {
+        return checkpoint.seq_num <= seq;
+    })};
+    if (it == checkpoints_.begin())
+    {
+        return {0, 1, 0};
+    }
+    return *std::prev(it);
+}
+
+std::uint64_t Session_Index::msg_count() const
+{
+    return header_->msg_count;
+}
@@ -0,0 +1,66 @@
+#ifndef SESSION_INDEX_H
+#define SESSION_INDEX_H
+
+#include "itch_file.h"
+
+#include "jamutils/M_Map.h"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <thread>
+
+// sidecar index (<itch file>.idx) of message boundaries every config::index_checkpoint_interval
+// messages, lets the downstream seek straight to a start time instead of walking the file
+class Session_Index
+{
+  public:
+    struct Checkpoint
+    {
+        std::uint64_t file_pos;
+        std::uint64_t seq_num;
+        std::uint64_t timestamp;
+    };
+
+    static std::filesystem::path sidecar_path(const std::filesystem::path& itch_file_path);
+
+    static void build(const std::filesystem::path& itch_file_path,
+                      const Itch_File& itch_file,
+                      std::size_t num_threads = std::thread::hardware_concurrency());
+
+    // false if the sidecar is missing or was built for a different version of the file
+    static bool is_current(const std::filesystem::path& itch_file_path,
+                           const Itch_File& itch_file);
+
+    explicit Session_Index(const std::filesystem::path& itch_file_path);
+
+    // last checkpoint before timestamp, or the start of the file
+    Checkpoint seek(std::chrono::nanoseconds timestamp) const;
+
+    // last checkpoint at or before seq
+    Checkpoint checkpoint_before(std::uint64_t seq) const;
+
+    std::uint64_t msg_count() const;
+
+  private:
+    struct __attribute__((__packed__)) Header
+    {
+        std::array<char, 8> magic;
+        std::uint64_t itch_file_len;
+        std::int64_t itch_file_mtime;
+        std::uint64_t checkpoint_interval;
+        std::uint64_t checkpoint_count;
+        std::uint64_t msg_count;
+    };
+
+    static constexpr std::array<char, 8> magic{'I', 'M', 'R', 'I', 'D', 'X', '0', '1'};
+
+    jam_utils::M_Map sidecar_;
+    const Header* header_;
+    std::span<const Checkpoint> checkpoints_;
+};
+
+#endif
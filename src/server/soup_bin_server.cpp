@@ -0,0 +1,466 @@
+#include "soup_bin_server.h"
+#include "config.h"
+#include "itch.h"
+#include "soup_bin_tcp.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <print>
+#include <stdexcept>
+#include <system_error>
+
+Soup_Bin_Server::Soup_Bin_Server(std::string_view session,
+                                 std::string_view address,
+                                 std::uint16_t port,
+                                 Itch_File& itch_file,
+                                 Message_Buffer& msg_buffer,
+                                 const Message_Filter& filter,
+                                 Soup_Bin_Metrics& metrics)
+    : session_{session},
+      itch_file_{itch_file},
+      msg_buffer_{msg_buffer},
+      filter_{filter},
+      metrics_{metrics},
+      listen_sock_{socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)},
+      wake_fd_{eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)},
+      epoll_fd_{epoll_create1(EPOLL_CLOEXEC)}
+{
+    if (session_.length() != soup_bin_tcp::session_len)
+    {
+        throw std::invalid_argument(std::format("session {} has length {} expected {}", session_, session_.length(), soup_bin_tcp::session_len));
+    }
+
+    constexpr auto opt{1};
+    if (setsockopt(listen_sock_.fd(), SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+    {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+
+    if (const auto ret{inet_pton(AF_INET, address.data(), &addr.sin_addr)}; ret == 0)
+    {
+        throw std::invalid_argument(std::format("invalid ip format for SoupBinTCP address {}", address));
+    }
+    else if (ret < 0)
+    {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    if (bind(listen_sock_.fd(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        listen(listen_sock_.fd(), SOMAXCONN) < 0)
+    {
+        throw std::system_error(errno, std::system_category(), std::format("SoupBinTCP port {}", port));
+    }
+
+    for (const int fd : {listen_sock_.fd(), wake_fd_.fd()})
+    {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_ADD, fd, &event) < 0)
+        {
+            throw std::system_error(errno, std::system_category());
+        }
+    }
+
+    thread_ = std::jthread{[this](const std::stop_token& stop) { run(stop); }};
+}
+
+Soup_Bin_Server::~Soup_Bin_Server()
+{
+    thread_.request_stop();
+    eventfd_write(wake_fd_.fd(), 1);
+    thread_.join();
+}
+
+void Soup_Bin_Server::run(const std::stop_token& stop)
+{
+    bool busy{false};
+    bool ended{false};
+    while (!stop.stop_requested())
+    {
+        // skip the sleep if the downstream published while the last pass ran, otherwise it
+        // sees waiting_ and wakes us
+        waiting_.store(true);
+        const bool pending{busy || published_.load() != available_ || ended_.load() != ended};
+        const int nfds{epoll_wait(epoll_fd_.fd(),
+                                  events_.data(),
+                                  config::epoll_max_events,
+                                  pending ? 0 : static_cast<int>(config::soup_bin_poll_interval.count()))};
+        waiting_.store(false);
+        if (nfds < 0 && errno != EINTR)
+        {
+            throw std::system_error(errno, std::system_category());
+        }
+
+        const auto now{std::chrono::steady_clock::now()};
+        for (std::size_t i = 0; i < static_cast<std::size_t>(std::max(nfds, 0)); ++i)
+        {
+            const epoll_event& ev{events_[i]};
+            if (ev.data.fd == listen_sock_.fd())
+            {
+                accept_clients(now);
+            }
+            else if (ev.data.fd == wake_fd_.fd())
+            {
+                eventfd_t count{};
+                eventfd_read(wake_fd_.fd(), &count);
+            }
+            else if (const auto it{clients_.find(ev.data.fd)}; it != clients_.end())
+            {
+                if ((ev.events & EPOLLOUT) != 0)
+                {
+                    it->second.writable = true;
+                }
+                if ((ev.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0)
+                {
+                    receive(it->second, now);
+                }
+            }
+        }
+
+        // one send per client per pass so a client catching up from early in the session
+        // doesn't starve the live ones
+        available_ = published_.load(std::memory_order_acquire);
+        ended = ended_.load();
+        busy = false;
+        std::uint64_t max_lag{0};
+        for (auto& [fd, client] : clients_)
+        {
+            busy |= service(client, now);
+            if (client.logged_in && !client.closed)
+            {
+                max_lag = std::max(max_lag, available_ - std::min(client.next_seq, available_));
+            }
+        }
+        std::erase_if(clients_, [](const auto& entry) { return entry.second.closed; });
+        metrics_.clients.set(static_cast<std::int64_t>(clients_.size()));
+        metrics_.max_client_lag.set(static_cast<std::int64_t>(max_lag));
+    }
+}
+
+void Soup_Bin_Server::accept_clients(std::chrono::steady_clock::time_point now)
+{
+    while (true)
+    {
+        const int fd{accept4(listen_sock_.fd(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)};
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            if (errno != EAGAIN)
+            {
+                std::perror("accept4");
+            }
+            return;
+        }
+        clients_.try_emplace(fd, fd, now);
+
+        constexpr auto opt{1};
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+        // edge triggered EPOLLOUT reports the socket buffer draining after a short write
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll_fd_.fd(), EPOLL_CTL_ADD, fd, &event) < 0)
+        {
+            std::perror("epoll_ctl");
+            clients_.erase(fd);
+        }
+    }
+}
+
+void Soup_Bin_Server::receive(Client& client, std::chrono::steady_clock::time_point now)
+{
+    while (!client.closed)
+    {
+        const auto ret{recv(client.sock.fd(), client.in.data() + client.in_len, client.in.size() - client.in_len, 0)};
+        if (ret == 0)
+        {
+            client.closed = true;
+            return;
+        }
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            client.closed = errno != EAGAIN;
+            return;
+        }
+        client.in_len += static_cast<std::size_t>(ret);
+        client.last_received = now;
+
+        std::size_t consumed{0};
+        while (client.in_len - consumed >= soup_bin_tcp::len_prefix_size)
+        {
+            std::uint16_t packet_len{};
+            std::memcpy(&packet_len, client.in.data() + consumed, sizeof(packet_len));
+            packet_len = be16toh(packet_len);
+            if (packet_len == 0 || soup_bin_tcp::len_prefix_size + packet_len > client.in.size())
+            {
+                std::println(std::cerr, "SoupBinTCP client sent a {} byte packet, disconnecting", packet_len);
+                client.closed = true;
+                return;
+            }
+            if (client.in_len - consumed < soup_bin_tcp::len_prefix_size + packet_len)
+            {
+                break;
+            }
+            handle_packet(client,
+                          client.in[consumed + soup_bin_tcp::len_prefix_size],
+                          {client.in.data() + consumed + soup_bin_tcp::header_size, packet_len - 1U});
+            consumed += soup_bin_tcp::len_prefix_size + packet_len;
+        }
+        std::memmove(client.in.data(), client.in.data() + consumed, client.in_len - consumed);
+        client.in_len -= consumed;
+    }
+}
+
+void Soup_Bin_Server::handle_packet(Client& client, char type, std::string_view payload)
+{
+    if (!client.logged_in && type != soup_bin_tcp::login_request)
+    {
+        client.closed = true;
+        return;
+    }
+
+    switch (type)
+    {
+    case soup_bin_tcp::login_request:
+        if (client.logged_in || client.closing || payload.size() != soup_bin_tcp::login_request_len)
+        {
+            client.closed = true;
+            return;
+        }
+        login(client, payload);
+        break;
+    case soup_bin_tcp::logout_request:
+        client.closed = true;
+        break;
+    case soup_bin_tcp::client_heartbeat:
+    case soup_bin_tcp::unsequenced_data:
+    case soup_bin_tcp::debug:
+        break;
+    default:
+        client.closed = true;
+        break;
+    }
+}
+
+void Soup_Bin_Server::login(Client& client, std::string_view request)
+{
+    // credentials aren't checked, this is a replay
+    const auto requested_session{request.substr(soup_bin_tcp::username_len + soup_bin_tcp::password_len,
+                                                 soup_bin_tcp::session_len)};
+    if (requested_session.find_first_not_of(' ') != std::string_view::npos && requested_session != session_)
+    {
+        queue_packet(client, soup_bin_tcp::login_rejected, {&soup_bin_tcp::session_not_available, 1});
+        client.closing = true;
+        metrics_.rejected_logins.add();
+        return;
+    }
+
+    auto requested_seq{request.substr(soup_bin_tcp::username_len + soup_bin_tcp::password_len + soup_bin_tcp::session_len)};
+    requested_seq.remove_prefix(std::min(requested_seq.find_first_not_of(' '), requested_seq.size()));
+    std::uint64_t seq{0};
+    std::from_chars(requested_seq.data(), requested_seq.data() + requested_seq.size(), seq);
+
+    // 0 (most recent) and sequence numbers not sent yet join live, so do ones from
+    // before the buffer when there is no index to find them
+    client.next_seq = available_;
+    client.next_pos.reset();
+    if (seq != 0 && seq < available_)
+    {
+        if (const auto pos{msg_buffer_.get_file_pos(seq)})
+        {
+            client.next_seq = seq;
+            client.next_pos = pos;
+        }
+    }
+    client.logged_in = true;
+    metrics_.logins.add();
+
+    queue_packet(client, soup_bin_tcp::login_accepted, std::format("{}{:>20}", session_, client.next_seq));
+}
+
+bool Soup_Bin_Server::service(Client& client, std::chrono::steady_clock::time_point now)
+{
+    if (client.closed)
+    {
+        return false;
+    }
+    if (now - client.last_received > soup_bin_tcp::client_timeout)
+    {
+        metrics_.timeouts.add();
+        client.closed = true;
+        return false;
+    }
+
+    if (client.logged_in && !client.closing && client.next_seq >= available_ && client.partial == 0)
+    {
+        if (ended_.load(std::memory_order_relaxed))
+        {
+            queue_packet(client, soup_bin_tcp::end_of_session, {});
+            client.closing = true;
+        }
+        else if (now - client.last_sent >= soup_bin_tcp::heartbeat_interval && client.control.empty())
+        {
+            queue_packet(client, soup_bin_tcp::server_heartbeat, {});
+        }
+    }
+
+    const bool more{client.writable && send(client, now)};
+    if (client.closing && client.control.empty())
+    {
+        client.closed = true;
+    }
+    return more;
+}
+
+bool Soup_Bin_Server::send(Client& client, std::chrono::steady_clock::time_point now)
+{
+    std::size_t num_iovs{0};
+    std::size_t num_slots{0};
+    if (!client.control.empty())
+    {
+        iovs_[num_iovs++] = {client.control.data(), client.control.size()};
+    }
+
+    if (client.logged_in && !client.closing && client.next_seq < available_)
+    {
+        if (!client.next_pos)
+        {
+            client.next_pos = msg_buffer_.get_file_pos(client.next_seq);
+            if (!client.next_pos)
+            {
+                std::println(std::cerr, "SoupBinTCP no file position for sequence {}, disconnecting", client.next_seq);
+                client.closed = true;
+                return false;
+            }
+        }
+
+        // every message before available_ has been packetized so the walk stays inside what
+        // the downstream has already read
+        auto pos{*client.next_pos};
+        auto seq{client.next_seq};
+        auto skip{client.partial};
+        while (seq < available_ && num_iovs + 2 <= iovs_.size())
+        {
+            while (!filter_.accept(itch_file_.at(pos)))
+            {
+                pos += itch::len_prefix_size + itch::extract_len(itch_file_.at(pos));
+            }
+            const auto msg_len{itch::extract_len(itch_file_.at(pos))};
+            const auto packet_len{static_cast<std::uint16_t>(msg_len + 1U)};
+
+            auto& slot{slots_[num_slots++]};
+            slot.header = {static_cast<char>(packet_len >> 8U),
+                           static_cast<char>(packet_len & 0xFFU),
+                           soup_bin_tcp::sequenced_data};
+            slot.pos = pos;
+            slot.end = pos + itch::len_prefix_size + msg_len;
+            slot.len = soup_bin_tcp::header_size + msg_len - skip;
+
+            // only the first message can have been partly written
+            if (skip < soup_bin_tcp::header_size)
+            {
+                iovs_[num_iovs++] = {slot.header.data() + skip, soup_bin_tcp::header_size - skip};
+                skip = soup_bin_tcp::header_size;
+            }
+            const auto payload_skip{skip - soup_bin_tcp::header_size};
+            iovs_[num_iovs++] = {itch_file_.at(pos + itch::len_prefix_size + payload_skip), msg_len - payload_skip};
+
+            skip = 0;
+            pos = slot.end;
+            ++seq;
+        }
+    }
+
+    if (num_iovs == 0)
+    {
+        return false;
+    }
+
+    // sendmsg rather than writev for MSG_NOSIGNAL, a client resetting mustn't SIGPIPE us
+    std::size_t requested{0};
+    for (std::size_t i = 0; i < num_iovs; ++i)
+    {
+        requested += iovs_[i].iov_len;
+    }
+    msghdr msg{};
+    msg.msg_iov = iovs_.data();
+    msg.msg_iovlen = num_iovs;
+    const auto ret{sendmsg(client.sock.fd(), &msg, MSG_NOSIGNAL | MSG_DONTWAIT)};
+    if (ret < 0)
+    {
+        if (errno == EAGAIN)
+        {
+            client.writable = false;
+            metrics_.stalls.add();
+        }
+        else if (errno != EINTR)
+        {
+            client.closed = true;
+        }
+        return false;
+    }
+
+    auto written{static_cast<std::size_t>(ret)};
+    metrics_.bytes_sent.add(written);
+    client.last_sent = now;
+
+    const auto control_written{std::min(written, client.control.size())};
+    client.control.erase(0, control_written);
+    written -= control_written;
+
+    for (std::size_t i = 0; i < num_slots; ++i)
+    {
+        const auto& slot{slots_[i]};
+        if (written < slot.len)
+        {
+            client.partial += written;
+            client.next_pos = slot.pos;
+            break;
+        }
+        written -= slot.len;
+        client.partial = 0;
+        client.next_pos = slot.end;
+        ++client.next_seq;
+        metrics_.msgs_sent.add();
+    }
+
+    // a short write means the socket buffer is full, wait for EPOLLOUT
+    if (static_cast<std::size_t>(ret) < requested)
+    {
+        client.writable = false;
+        metrics_.stalls.add();
+        return false;
+    }
+    return client.next_seq < available_;
+}
+
+void Soup_Bin_Server::queue_packet(Client& client, char type, std::string_view payload)
+{
+    const auto packet_len{static_cast<std::uint16_t>(payload.size() + 1)};
+    client.control.push_back(static_cast<char>(packet_len >> 8U));
+    client.control.push_back(static_cast<char>(packet_len & 0xFFU));
+    client.control.push_back(type);
+    client.control.append(payload);
+}
@@ -0,0 +1,137 @@
+#ifndef SOUP_BIN_SERVER_H
+#define SOUP_BIN_SERVER_H
+
+#include "config.h"
+#include "itch_file.h"
+#include "message_buffer.h"
+#include "message_filter.h"
+#include "metrics.h"
+#include "soup_bin_tcp.h"
+
+#include "jamutils/M_Map.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+
+// SoupBinTCP delivery of one channel for consumers which can't join the multicast group.
+// One thread serves every client: each has its own sequence cursor and is written from
+// the mapping with one scatter/gather send per pass, a header iovec and a payload iovec
+// per message. The downstream only publishes how far it has sent, so a slow client just
+// falls behind in its own socket buffer and never holds up pacing. Clients may log in at
+// any sequence number already sent, the Message_Buffer finds where to start
+class Soup_Bin_Server
+{
+  public:
+    Soup_Bin_Server(std::string_view session,
+                    std::string_view address,
+                    std::uint16_t port,
+                    Itch_File& itch_file,
+                    Message_Buffer& msg_buffer,
+                    const Message_Filter& filter,
+                    Soup_Bin_Metrics& metrics);
+    ~Soup_Bin_Server();
+
+    Soup_Bin_Server(const Soup_Bin_Server&) = delete;
+    Soup_Bin_Server& operator=(const Soup_Bin_Server&) = delete;
+
+    // called by the downstream thread once every message before next_seq has been sent,
+    // a store and, only while the server thread is asleep, an eventfd write
+    void publish(std::uint64_t next_seq)
+    {
+        published_.store(next_seq);
+        wake();
+    }
+
+    // clients are sent End of Session once caught up
+    void end_of_session()
+    {
+        ended_.store(true);
+        wake();
+    }
+
+  private:
+    struct Client
+    {
+        jam_utils::FD sock;
+        bool logged_in{false};
+        bool writable{true}; // cleared by a short write until EPOLLOUT
+        bool closing{false}; // close once control is written
+        bool closed{false}; // removed at the end of the pass
+        std::uint64_t next_seq{};
+        std::optional<std::size_t> next_pos; // resolved on the first send after login
+        std::size_t partial{}; // bytes of next_seq's packet already written
+        std::string control; // packets other than sequenced data, written first
+        std::array<char, config::soup_bin_client_buffer> in{};
+        std::size_t in_len{};
+        std::chrono::steady_clock::time_point last_sent;
+        std::chrono::steady_clock::time_point last_received;
+
+        Client(int fd, std::chrono::steady_clock::time_point now)
+            : sock{fd},
+              last_sent{now},
+              last_received{now}
+        {
+        }
+    };
+
+    // one message of a send, to advance the client's cursor by what was written
+    struct Send_Slot
+    {
+        std::array<char, soup_bin_tcp::header_size> header;
+        std::size_t pos; // of the message in the file
+        std::size_t end;
+        std::size_t len; // packet length including the header, less what was already written
+    };
+
+    void wake()
+    {
+        // seq_cst pairs with the server thread setting waiting_ then checking published_
+        if (waiting_.load() && waiting_.exchange(false))
+        {
+            eventfd_write(wake_fd_.fd(), 1);
+        }
+    }
+
+    void run(const std::stop_token& stop);
+    void accept_clients(std::chrono::steady_clock::time_point now);
+    void receive(Client& client, std::chrono::steady_clock::time_point now);
+    void handle_packet(Client& client, char type, std::string_view payload);
+    void login(Client& client, std::string_view request);
+    bool service(Client& client, std::chrono::steady_clock::time_point now);
+    bool send(Client& client, std::chrono::steady_clock::time_point now);
+    static void queue_packet(Client& client, char type, std::string_view payload);
+
+    std::string session_;
+    Itch_File& itch_file_;
+    Message_Buffer& msg_buffer_;
+    const Message_Filter& filter_;
+    Soup_Bin_Metrics& metrics_;
+
+    jam_utils::FD listen_sock_;
+    jam_utils::FD wake_fd_;
+    jam_utils::FD epoll_fd_;
+    std::array<epoll_event, config::epoll_max_events> events_{};
+    std::unordered_map<int, Client> clients_;
+
+    std::array<iovec, config::soup_bin_writev_iovs> iovs_{};
+    std::array<Send_Slot, config::soup_bin_writev_iovs / 2> slots_{};
+
+    // messages before this have been sent downstream, published_ as of the current pass
+    std::uint64_t available_{1};
+    std::atomic<std::uint64_t> published_{1};
+    std::atomic<bool> ended_{false};
+    std::atomic<bool> waiting_{false};
+    std::jthread thread_;
+};
+
+#endif
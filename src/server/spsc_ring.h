@@ -0,0 +1,96 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+// bounded single producer single consumer queue of preallocated slots. The producer fills a
+// slot in place then publishes it, the consumer reads it in place then pops it, so nothing is
+// copied or allocated. Each side caches the other's index and only reads it again when the ring
+// looks full or empty, and blocks on it with atomic wait only then
+template <typename T>
+class Spsc_Ring
+{
+  public:
+    Spsc_Ring(std::size_t capacity, const T& init)
+        : slots_(capacity, init)
+    {
+    }
+
+    std::size_t capacity() const { return slots_.size(); }
+    std::size_t size() const { return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire); }
+
+    // producer, the next slot to fill waiting for one to free up, nullptr once closed
+    T* claim()
+    {
+        const auto head{head_.load(std::memory_order_relaxed)};
+        while (head - cached_tail_ == slots_.size())
+        {
+            tail_.wait(cached_tail_, std::memory_order_acquire);
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+        }
+        // close() moves tail_ so a full ring looks free, ordered before it
+        if (closed_.load(std::memory_order_relaxed))
+        {
+            return nullptr;
+        }
+        return &slots_[head % slots_.size()];
+    }
+
+    void publish()
+    {
+        head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        head_.notify_one();
+    }
+
+    // consumer, the oldest published slot or nullptr if there is none
+    T* try_front()
+    {
+        const auto tail{tail_.load(std::memory_order_relaxed)};
+        if (tail == cached_head_)
+        {
+            cached_head_ = head_.load(std::memory_order_acquire);
+            if (tail == cached_head_)
+            {
+                return nullptr;
+            }
+        }
+        return &slots_[tail % slots_.size()];
+    }
+
+    // consumer, waits for a slot to be published
+    T& front()
+    {
+        while (try_front() == nullptr)
+        {
+            head_.wait(cached_head_, std::memory_order_acquire);
+        }
+        return slots_[tail_.load(std::memory_order_relaxed) % slots_.size()];
+    }
+
+    void pop()
+    {
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        tail_.notify_one();
+    }
+
+    // consumer giving up, wakes a waiting producer for good
+    void close()
+    {
+        closed_.store(true, std::memory_order_release);
+        tail_.store(std::numeric_limits<std::size_t>::max(), std::memory_order_release);
+        tail_.notify_one();
+    }
+
+  private:
+    std::vector<T> slots_;
+    alignas(64) std::atomic<std::size_t> head_{0}; // next slot the producer publishes
+    std::size_t cached_tail_{0};
+    alignas(64) std::atomic<std::size_t> tail_{0}; // next slot the consumer pops
+    std::size_t cached_head_{0};
+    alignas(64) std::atomic<bool> closed_{false};
+};
+
+#endif
@@ -0,0 +1,89 @@
+#include "stock_directory.h"
+#include "itch.h"
+
+#include <charconv>
+#include <fstream>
+#include <stdexcept>
+#include <format>
+
+Stock_Directory::Stock_Directory(const Itch_File& itch_file)
+{
+    std::size_t pos{0};
+    while (pos + itch::len_prefix_size <= itch_file.ensure(pos + itch::len_prefix_size + itch::max_msg_len))
+    {
+        const auto* msg{itch_file.at(pos)};
+        const std::size_t total_msg_len{itch::len_prefix_size + itch::extract_len(msg)};
+        if (pos + total_msg_len > itch_file.len())
+        {
+            throw std::runtime_error("ITCH message exceeds file size");
+        }
+
+        const auto type{itch::extract_msg_type(msg)};
+        if (type == 'R' && total_msg_len >= itch::stock_offset + itch::stock_len)
+        {
+            std::string symbol{reinterpret_cast<const char*>(msg + itch::stock_offset), itch::stock_len};
+            symbol.erase(symbol.find_last_not_of(' ') + 1);
+            locates_.emplace(std::move(symbol), itch::extract_stock_locate(msg));
+        }
+        else if (type == 'S' && static_cast<char>(msg[itch::event_code_offset]) == itch::start_of_market_hours)
+        {
+            break;
+        }
+        pos += total_msg_len;
+    }
+}
+
+std::optional<std::uint16_t> Stock_Directory::locate(std::string_view symbol) const
+{
+    if (const auto it{locates_.find(std::string{symbol})}; it != locates_.end())
+    {
+        return it->second;
+    }
+    return std::nullopt;
+}
+
+std::vector<std::size_t> Stock_Directory::assign_channels(std::size_t num_channels,
+                                                          const std::filesystem::path& channel_map_path) const
+{
+    std::vector<std::size_t> channel_by_locate(itch::max_stock_locate + 1);
+    for (std::size_t locate = 0; locate < channel_by_locate.size(); ++locate)
+    {
+        channel_by_locate[locate] = locate % num_channels;
+    }
+
+    if (channel_map_path.empty())
+    {
+        return channel_by_locate;
+    }
+
+    std::ifstream in{channel_map_path};
+    if (!in)
+    {
+        throw std::runtime_error(std::format("could not open channel map {}", channel_map_path.string()));
+    }
+
+    std::string line;
+    for (std::size_t line_num = 1; std::getline(in, line); ++line_num)
+    {
+        if (line.empty() || line.front() == '#')
+        {
+            continue;
+        }
+        const auto comma{line.find(',')};
+        std::size_t channel{};
+        if (comma == std::string::npos ||
+            std::from_chars(line.data() + comma + 1, line.data() + line.size(), channel).ec != std::errc{} ||
+            channel >= num_channels)
+        {
+            throw std::runtime_error(std::format("{}:{} expected SYMBOL,channel with channel < {}",
+                                                 channel_map_path.string(),
+                                                 line_num,
+                                                 num_channels));
+        }
+        if (const auto stock_locate{locate(std::string_view{line}.substr(0, comma))})
+        {
+            channel_by_locate[*stock_locate] = channel;
+        }
+    }
+    return channel_by_locate;
+}
@@ -0,0 +1,34 @@
+#ifndef STOCK_DIRECTORY_H
+#define STOCK_DIRECTORY_H
+
+#include "itch_file.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// symbol -> stock locate from the stock directory ('R') messages, which are all sent
+// before the start of market hours so the scan stops there
+class Stock_Directory
+{
+  public:
+    explicit Stock_Directory(const Itch_File& itch_file);
+
+    std::optional<std::uint16_t> locate(std::string_view symbol) const;
+
+    std::size_t size() const { return locates_.size(); }
+
+    // channel of every stock locate: from the SYMBOL,channel lines of channel_map_path when
+    // given, with unmapped or unlisted locates spread round robin
+    std::vector<std::size_t> assign_channels(std::size_t num_channels,
+                                             const std::filesystem::path& channel_map_path) const;
+
+  private:
+    std::unordered_map<std::string, std::uint16_t> locates_;
+};
+
+#endif
@@ -0,0 +1,290 @@
+#include "thread_placement.h"
+
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <climits>
+#include <filesystem>
+#include <format>
+#include <ranges>
+#include <stdexcept>
+#include <system_error>
+
+namespace
+{
+std::vector<int> allowed_cpus()
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) < 0)
+    {
+        throw std::system_error(errno, std::system_category(), "sched_getaffinity");
+    }
+    std::vector<int> cpus;
+    for (std::size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (CPU_ISSET(cpu, &set))
+        {
+            cpus.push_back(static_cast<int>(cpu));
+        }
+    }
+    return cpus;
+}
+
+// -1 when sysfs doesn't say
+int cpu_node(int cpu)
+{
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator{std::format("/sys/devices/system/cpu/cpu{}", cpu), ec})
+    {
+        const auto name{entry.path().filename().string()};
+        int node{};
+        if (name.starts_with("node") &&
+            std::from_chars(name.data() + 4, name.data() + name.size(), node).ec == std::errc{})
+        {
+            return node;
+        }
+    }
+    return -1;
+}
+
+bool contains(const std::vector<int>& cpus, int cpu)
+{
+    return std::ranges::find(cpus, cpu) != cpus.end();
+}
+} // namespace
+
+std::vector<int> parse_cpu_list(std::string_view list)
+{
+    std::vector<int> cpus;
+    for (const auto part : std::views::split(list, ','))
+    {
+        const std::string_view range{part};
+        const auto dash{range.find('-')};
+        const auto first_str{range.substr(0, dash)};
+        const auto last_str{dash == std::string_view::npos ? first_str : range.substr(dash + 1)};
+
+        int first{};
+        int last{};
+        if (std::from_chars(first_str.data(), first_str.data() + first_str.size(), first).ec != std::errc{} ||
+            std::from_chars(last_str.data(), last_str.data() + last_str.size(), last).ec != std::errc{} ||
+            first < 0 || last < first || last >= CPU_SETSIZE)
+        {
+            throw std::invalid_argument(std::format("invalid CPU list {}, expected e.g. 0-3,8", list));
+        }
+        for (int cpu = first; cpu <= last; ++cpu)
+        {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+std::string format_cpu_list(const std::vector<int>& cpus)
+{
+    auto sorted{cpus};
+    std::ranges::sort(sorted);
+    std::string list;
+    for (std::size_t i = 0; i < sorted.size();)
+    {
+        auto j{i};
+        while (j + 1 < sorted.size() && sorted[j + 1] == sorted[j] + 1)
+        {
+            ++j;
+        }
+        list += std::format("{}{}", list.empty() ? "" : ",", sorted[i]);
+        if (j > i)
+        {
+            list += std::format("-{}", sorted[j]);
+        }
+        i = j + 1;
+    }
+    return list;
+}
+
+void pin_thread(const std::vector<int>& cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const auto cpu : cpus)
+    {
+        CPU_SET(static_cast<std::size_t>(cpu), &set);
+    }
+    if (const auto err{pthread_setaffinity_np(pthread_self(), sizeof(set), &set)}; err != 0)
+    {
+        throw std::system_error(err, std::system_category(), std::format("pinning thread to CPUs {}", format_cpu_list(cpus)));
+    }
+}
+
+Thread_Placement::Thread_Placement(std::vector<int> downstream_cpus,
+                                   std::vector<int> retrans_cpus,
+                                   int numa_node,
+                                   int fifo_priority,
+                                   std::size_t num_senders)
+    : allowed_cpus_{allowed_cpus()},
+      downstream_cpus_{std::move(downstream_cpus)},
+      retrans_cpus_{std::move(retrans_cpus)},
+      numa_node_{numa_node},
+      fifo_priority_{fifo_priority}
+{
+    if (!downstream_cpus_.empty() && downstream_cpus_.size() != num_senders)
+    {
+        throw std::invalid_argument(std::format("--downstream-cpus lists {} CPUs for {} downstream senders",
+                                                downstream_cpus_.size(),
+                                                num_senders));
+    }
+    for (std::size_t i = 0; i < downstream_cpus_.size(); ++i)
+    {
+        const auto cpu{downstream_cpus_[i]};
+        if (!contains(allowed_cpus_, cpu))
+        {
+            throw std::invalid_argument(std::format("downstream CPU {} is not one this process may run on ({})",
+                                                    cpu,
+                                                    format_cpu_list(allowed_cpus_)));
+        }
+        if (std::ranges::find(downstream_cpus_.begin(), downstream_cpus_.begin() + static_cast<std::ptrdiff_t>(i), cpu) !=
+            downstream_cpus_.begin() + static_cast<std::ptrdiff_t>(i))
+        {
+            throw std::invalid_argument(std::format("downstream CPU {} given to two senders", cpu));
+        }
+    }
+    for (const auto cpu : retrans_cpus_)
+    {
+        if (!contains(allowed_cpus_, cpu))
+        {
+            throw std::invalid_argument(std::format("retransmission CPU {} is not one this process may run on ({})",
+                                                    cpu,
+                                                    format_cpu_list(allowed_cpus_)));
+        }
+        if (contains(downstream_cpus_, cpu))
+        {
+            throw std::invalid_argument(std::format("CPU {} given to both a downstream sender and the retransmission workers", cpu));
+        }
+    }
+
+    for (const auto cpu : allowed_cpus_)
+    {
+        if (!contains(downstream_cpus_, cpu))
+        {
+            other_cpus_.push_back(cpu);
+        }
+    }
+    if (other_cpus_.empty())
+    {
+        throw std::invalid_argument("--downstream-cpus leaves no CPU for the retransmission workers and other threads");
+    }
+
+    if (numa_node_ >= 0 && !std::filesystem::exists(std::format("/sys/devices/system/node/node{}", numa_node_)))
+    {
+        throw std::invalid_argument(std::format("NUMA node {} does not exist", numa_node_));
+    }
+
+    if (fifo_priority_ > 0)
+    {
+        if (fifo_priority_ < sched_get_priority_min(SCHED_FIFO) || fifo_priority_ > sched_get_priority_max(SCHED_FIFO))
+        {
+            throw std::invalid_argument(std::format("SCHED_FIFO priority {} outside [{} - {}]",
+                                                    fifo_priority_,
+                                                    sched_get_priority_min(SCHED_FIFO),
+                                                    sched_get_priority_max(SCHED_FIFO)));
+        }
+        // find out now rather than once the senders start, going back to SCHED_OTHER is always allowed
+        sched_param param{};
+        param.sched_priority = fifo_priority_;
+        if (const auto err{pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)}; err != 0)
+        {
+            throw std::system_error(err,
+                                    std::system_category(),
+                                    std::format("SCHED_FIFO priority {} (needs CAP_SYS_NICE or RLIMIT_RTPRIO)", fifo_priority_));
+        }
+        param.sched_priority = 0;
+        pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+    }
+}
+
+void Thread_Placement::apply() const
+{
+    if (!downstream_cpus_.empty())
+    {
+        pin_thread(other_cpus_);
+    }
+
+    if (numa_node_ >= 0)
+    {
+        // page cache and anonymous pages first touched by any thread from here on, the file's
+        // pages already cached by an earlier run stay on whichever node they were read into
+        constexpr std::size_t mask_bits{sizeof(unsigned long) * CHAR_BIT};
+        std::array<unsigned long, 16> mask{};
+        const auto node{static_cast<std::size_t>(numa_node_)};
+        if (node >= mask.size() * mask_bits)
+        {
+            throw std::invalid_argument(std::format("NUMA node {} too large", numa_node_));
+        }
+        mask[node / mask_bits] |= 1UL << (node % mask_bits);
+        if (syscall(SYS_set_mempolicy, MPOL_BIND, mask.data(), mask.size() * mask_bits + 1) < 0)
+        {
+            throw std::system_error(errno, std::system_category(), std::format("binding memory to NUMA node {}", numa_node_));
+        }
+    }
+}
+
+void Thread_Placement::enter_downstream(std::size_t sender) const
+{
+    if (!downstream_cpus_.empty())
+    {
+        pin_thread({downstream_cpus_[sender]});
+    }
+    if (fifo_priority_ > 0)
+    {
+        sched_param param{};
+        param.sched_priority = fifo_priority_;
+        if (const auto err{pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)}; err != 0)
+        {
+            throw std::system_error(err, std::system_category(), std::format("SCHED_FIFO priority {}", fifo_priority_));
+        }
+    }
+}
+
+std::string Thread_Placement::report() const
+{
+    std::string report;
+    if (!downstream_cpus_.empty())
+    {
+        std::string cpus;
+        for (const auto cpu : downstream_cpus_)
+        {
+            cpus += std::format("{}{}", cpus.empty() ? "" : ",", cpu);
+        }
+        report += std::format("Downstream senders on CPUs {} in session then channel order, other threads on CPUs {}\n",
+                              cpus,
+                              format_cpu_list(other_cpus_));
+    }
+    if (!retrans_cpus_.empty())
+    {
+        report += std::format("Retransmission workers on CPUs {}\n", format_cpu_list(retrans_cpus_));
+    }
+    if (fifo_priority_ > 0)
+    {
+        report += std::format("Downstream senders at SCHED_FIFO priority {}\n", fifo_priority_);
+    }
+    if (numa_node_ >= 0)
+    {
+        report += std::format("Memory bound to NUMA node {}\n", numa_node_);
+        for (const auto cpu : downstream_cpus_)
+        {
+            if (const auto node{cpu_node(cpu)}; node >= 0 && node != numa_node_)
+            {
+                report += std::format("Downstream CPU {} is on NUMA node {}, it reads the file across the interconnect\n",
+                                      cpu,
+                                      node);
+            }
+        }
+    }
+    return report;
+}
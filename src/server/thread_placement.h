@@ -0,0 +1,49 @@
+#ifndef THREAD_PLACEMENT_H
+#define THREAD_PLACEMENT_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// CPU list in the taskset -c / sysfs format, e.g. 0-3,8
+std::vector<int> parse_cpu_list(std::string_view list);
+std::string format_cpu_list(const std::vector<int>& cpus);
+
+// pins the calling thread to cpus
+void pin_thread(const std::vector<int>& cpus);
+
+// where the process's threads run and its memory lives, checked against the CPUs and nodes
+// the process may use when constructed. Each downstream sender gets a CPU of its own, every
+// other thread (retransmission workers, SoupBinTCP, prefetch, metrics) is kept off those.
+// Empty lists, node -1 and priority 0 leave that part to the kernel
+class Thread_Placement
+{
+  public:
+    Thread_Placement(std::vector<int> downstream_cpus,
+                     std::vector<int> retrans_cpus,
+                     int numa_node,
+                     int fifo_priority,
+                     std::size_t num_senders);
+
+    // from the main thread before loading anything or starting threads, which inherit it
+    void apply() const;
+
+    // from downstream sender i's thread before it starts
+    void enter_downstream(std::size_t sender) const;
+
+    // CPU for each retransmission worker in turn, empty leaves them where apply() put them
+    const std::vector<int>& retrans_cpus() const { return retrans_cpus_; }
+
+    std::string report() const;
+
+  private:
+    std::vector<int> allowed_cpus_;
+    std::vector<int> downstream_cpus_;
+    std::vector<int> retrans_cpus_;
+    std::vector<int> other_cpus_;
+    int numa_node_;
+    int fifo_priority_;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#include "itch.h"
+#include "itch_file.h"
+#include "mold_udp_64.h"
+#include "packet_file.h"
+
+#include <CLI/App.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <print>
+#include <stdexcept>
+
+int main(const int argc, char** argv)
+{
+    CLI::App cli{"Compile a NASDAQ ITCH 5.0 file's downstream packets into the <itch_file>.pkt sidecar read by --packets"};
+
+    std::filesystem::path itch_file_path;
+    cli.add_option("itch_file",
+                   itch_file_path,
+                   "Uncompressed NASDAQ ITCH 5.0 binary message file")
+        ->required()
+        ->check(CLI::ExistingFile);
+
+    std::size_t mtu{mold_udp_64::mtu_size};
+    std::int64_t max_packet_delay_us{0};
+
+    cli.add_option("--mtu",
+                   mtu,
+                   "Largest downstream packet including IP and UDP headers, must match the replay's")
+        ->check(CLI::Range(mold_udp_64::udp_header_size + sizeof(mold_udp_64::Downstream_Header) + itch::len_prefix_size + itch::max_msg_len,
+                           mold_udp_64::max_jumbo_mtu_size))
+        ->capture_default_str();
+
+    cli.add_option("--max-packet-delay",
+                   max_packet_delay_us,
+                   "Microseconds after its first message's timestamp a packet is closed, must match the replay's")
+        ->check(CLI::NonNegativeNumber)
+        ->capture_default_str();
+
+    CLI11_PARSE(cli, argc, argv);
+
+    try
+    {
+        if (Itch_File::is_compressed(itch_file_path))
+        {
+            throw std::invalid_argument(std::format("{} is compressed, packets are sent straight from the uncompressed file",
+                                                    itch_file_path.string()));
+        }
+
+        const Itch_File itch_file{itch_file_path};
+        const auto start{std::chrono::steady_clock::now()};
+        Packet_File::build(itch_file_path, itch_file, mtu - mold_udp_64::udp_header_size, std::chrono::microseconds{max_packet_delay_us});
+
+        const Packet_File packet_file{itch_file_path};
+        std::println("Compiled {} messages into {} packets in {} ({} bytes) in {}",
+                     packet_file.msg_count(),
+                     packet_file.packets().size(),
+                     Packet_File::sidecar_path(itch_file_path).string(),
+                     std::filesystem::file_size(Packet_File::sidecar_path(itch_file_path)),
+                     std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start));
+        return 0;
+    }
+    catch (const std::exception& ex)
+    {
+        std::println(std::cerr, "{}", ex.what());
+        return -1;
+    }
+}
@@ -0,0 +1,128 @@
+#include "itch_generator.h"
+#include "nasdaq.h"
+
+#include <CLI/App.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <print>
+#include <string>
+
+int main(const int argc, char** argv)
+{
+    CLI::App cli{"Generate a synthetic NASDAQ ITCH 5.0 file"};
+
+    std::filesystem::path out_path;
+    cli.add_option("out_path",
+                   out_path,
+                   "Output ITCH file")
+        ->required();
+
+    std::size_t num_symbols{8000};
+    cli.add_option("--symbols",
+                   num_symbols,
+                   "Stocks in the directory, traffic is spread evenly across them")
+        ->check(CLI::Range(std::size_t{1}, std::size_t{65535}))
+        ->capture_default_str();
+
+    std::string mix_str{"A=40,F=2,E=6,C=1,X=5,D=35,U=8,P=3"};
+    cli.add_option("--mix",
+                   mix_str,
+                   "Relative weights of the order book message types (A, F, E, C, X, D, U, P)")
+        ->check([](const std::string& str) {
+            if (!parse_msg_mix(str))
+            {
+                return "mix must be TYPE=weight pairs of A, F, E, C, X, D, U, P separated by commas";
+            }
+            return "";
+        })
+        ->capture_default_str();
+
+    double rate{100'000};
+    cli.add_option("--rate",
+                   rate,
+                   "Average order book messages per second")
+        ->check(CLI::PositiveNumber)
+        ->capture_default_str();
+
+    auto rate_profile{Rate_Profile::intraday};
+    cli.add_option("--profile",
+                   rate_profile,
+                   "How the rate varies over the session (flat, intraday, bursty)")
+        ->transform(
+            CLI::CheckedTransformer(rate_profile_map,
+                                    CLI::ignore_case))
+        ->capture_default_str();
+
+    std::string start_time{"09:25:00"};
+    cli.add_option("--start-time",
+                   start_time,
+                   "Timestamp of the first message (HH:MM:SS[.fraction])")
+        ->check([](const std::string& str) {
+            if (!nasdaq::parse_time_of_day(str))
+            {
+                return "start time must be HH:MM:SS[.fraction]";
+            }
+            return "";
+        })
+        ->capture_default_str();
+
+    std::uint64_t max_msgs{10'000'000};
+    std::uint64_t max_bytes{0};
+    cli.add_option("--messages",
+                   max_msgs,
+                   "Order book messages to generate, 0 for no limit")
+        ->capture_default_str();
+    cli.add_option("--bytes",
+                   max_bytes,
+                   "Stop once the file reaches this size, 0 for no limit")
+        ->capture_default_str();
+
+    std::uint64_t seed{1};
+    cli.add_option("--seed",
+                   seed,
+                   "Random seed, the same options and seed give the same file")
+        ->capture_default_str();
+
+    CLI11_PARSE(cli, argc, argv);
+
+    if (max_msgs == 0 && max_bytes == 0)
+    {
+        std::println(std::cerr, "one of --messages or --bytes must be non zero");
+        return -1;
+    }
+
+    try
+    {
+        Itch_Generator generator{num_symbols,
+                                 *parse_msg_mix(mix_str),
+                                 rate,
+                                 rate_profile,
+                                 *nasdaq::parse_time_of_day(start_time),
+                                 seed};
+
+        std::ofstream out{out_path, std::ios::binary | std::ios::trunc};
+        const auto start{std::chrono::steady_clock::now()};
+        const auto msgs{generator.write(out, max_msgs, max_bytes)};
+        out.close();
+        if (!out)
+        {
+            std::println(std::cerr, "failed writing {}", out_path.string());
+            return -1;
+        }
+        std::println("Wrote {} messages ({} bytes) to {} in {}",
+                     msgs,
+                     std::filesystem::file_size(out_path),
+                     out_path.string(),
+                     std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start));
+        return 0;
+    }
+    catch (const std::exception& ex)
+    {
+        std::println(std::cerr, "{}", ex.what());
+        return -1;
+    }
+}
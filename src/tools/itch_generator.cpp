@@ -0,0 +1,371 @@
+#include "itch_generator.h"
+#include "itch.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <stdexcept>
+
+namespace
+{
+using namespace std::chrono_literals;
+
+constexpr std::uint64_t market_open{std::chrono::nanoseconds{9h + 30min}.count()};
+constexpr std::uint64_t market_close{std::chrono::nanoseconds{16h}.count()};
+// past this many live orders every order book message is a delete, keeps memory bounded
+constexpr std::size_t max_live_orders{1U << 20U};
+constexpr std::array<std::string_view, 4> mpids{"GSCO", "MSCO", "JPMS", "CDRG"};
+
+std::string symbol_for(std::size_t idx)
+{
+    // AAAA, AAAB, ... enough for every stock locate
+    std::string symbol(4, 'A');
+    for (auto it = symbol.rbegin(); it != symbol.rend(); ++it)
+    {
+        *it = static_cast<char>('A' + (idx % 26));
+        idx /= 26;
+    }
+    return symbol;
+}
+} // namespace
+
+std::optional<Msg_Mix> parse_msg_mix(std::string_view str)
+{
+    Msg_Mix mix;
+    while (!str.empty())
+    {
+        const auto end{std::min(str.find(','), str.size())};
+        const auto entry{str.substr(0, end)};
+        str.remove_prefix(std::min(end + 1, str.size()));
+
+        double weight{};
+        if (entry.size() < 3 || entry[1] != '=' ||
+            generated_msg_types.find(entry[0]) == std::string_view::npos ||
+            std::from_chars(entry.data() + 2, entry.data() + entry.size(), weight).ptr != entry.data() + entry.size() ||
+            weight < 0)
+        {
+            return std::nullopt;
+        }
+        mix[entry[0]] = weight;
+    }
+    if (std::ranges::all_of(mix, [](const auto& entry) { return entry.second <= 0; }))
+    {
+        return std::nullopt;
+    }
+    return mix;
+}
+
+Itch_Generator::Msg::Msg(char type, std::uint16_t locate, std::uint16_t tracking, std::uint64_t timestamp)
+    : len_{itch::len_prefix_size}
+{
+    u8(static_cast<std::uint8_t>(type)).u16(locate).u16(tracking).be(timestamp, itch::timestamp_size);
+}
+
+Itch_Generator::Msg& Itch_Generator::Msg::be(std::uint64_t val, std::size_t size)
+{
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        buf_[len_ + size - 1 - i] = static_cast<char>(val >> (8 * i));
+    }
+    len_ += size;
+    return *this;
+}
+
+Itch_Generator::Msg& Itch_Generator::Msg::u8(std::uint8_t val)
+{
+    return be(val, sizeof(val));
+}
+
+Itch_Generator::Msg& Itch_Generator::Msg::u16(std::uint16_t val)
+{
+    return be(val, sizeof(val));
+}
+
+Itch_Generator::Msg& Itch_Generator::Msg::u32(std::uint32_t val)
+{
+    return be(val, sizeof(val));
+}
+
+Itch_Generator::Msg& Itch_Generator::Msg::u64(std::uint64_t val)
+{
+    return be(val, sizeof(val));
+}
+
+Itch_Generator::Msg& Itch_Generator::Msg::alpha(std::string_view val, std::size_t len)
+{
+    // left justified, space padded
+    for (std::size_t i = 0; i < len; ++i)
+    {
+        buf_[len_ + i] = i < val.size() ? val[i] : ' ';
+    }
+    len_ += len;
+    return *this;
+}
+
+std::size_t Itch_Generator::Msg::emit(std::ostream& out)
+{
+    const auto msg_len{len_ - itch::len_prefix_size};
+    if (msg_len != itch::msg_len_by_type[static_cast<unsigned char>(buf_[itch::msg_type_offset])])
+    {
+        throw std::logic_error("generated message length does not match its type");
+    }
+    buf_[0] = static_cast<char>(msg_len >> 8U);
+    buf_[1] = static_cast<char>(msg_len);
+    out.write(buf_.data(), static_cast<std::streamsize>(len_));
+    return len_;
+}
+
+Itch_Generator::Itch_Generator(std::size_t num_symbols,
+                               const Msg_Mix& msg_mix,
+                               double rate,
+                               Rate_Profile rate_profile,
+                               std::chrono::nanoseconds start_time,
+                               std::uint64_t seed)
+    : rate_{rate},
+      rate_profile_{rate_profile},
+      rng_{seed},
+      timestamp_{static_cast<std::uint64_t>(start_time.count())}
+{
+    if (num_symbols == 0 || num_symbols > itch::max_stock_locate)
+    {
+        throw std::invalid_argument("symbol count must be in [1, 65535]");
+    }
+    if (rate <= 0)
+    {
+        throw std::invalid_argument("rate must be positive");
+    }
+
+    std::uniform_int_distribution<std::uint32_t> price_dist{10, 500};
+    for (std::size_t i = 0; i < num_symbols; ++i)
+    {
+        symbols_.push_back(symbol_for(i));
+        base_prices_.push_back(price_dist(rng_) * 10'000); // 4 implied decimals
+    }
+
+    std::vector<double> weights;
+    for (const auto& [type, weight] : msg_mix)
+    {
+        mix_types_.push_back(type);
+        weights.push_back(weight);
+    }
+    mix_dist_ = std::discrete_distribution<std::size_t>{weights.begin(), weights.end()};
+}
+
+std::uint64_t Itch_Generator::write(std::ostream& out, std::uint64_t max_msgs, std::uint64_t max_bytes)
+{
+    std::uint64_t bytes{0};
+    std::uint64_t msgs{0};
+    std::uint64_t traffic_msgs{0};
+    const auto emit{[&](std::size_t len) {
+        bytes += len;
+        ++msgs;
+    }};
+
+    emit(system_event(out, 'O', timestamp_)); // start of messages
+    for (std::size_t locate = 1; locate <= symbols_.size(); ++locate)
+    {
+        emit(stock_directory(out, static_cast<std::uint16_t>(locate)));
+    }
+    emit(system_event(out, 'S', timestamp_)); // start of system hours
+
+    bool open{false};
+    bool closed{false};
+    while ((max_msgs == 0 || traffic_msgs < max_msgs) && (max_bytes == 0 || bytes < max_bytes))
+    {
+        advance_clock();
+        if (!open && timestamp_ >= market_open)
+        {
+            emit(system_event(out, 'Q', timestamp_));
+            open = true;
+        }
+        if (!closed && timestamp_ >= market_close)
+        {
+            emit(system_event(out, 'M', timestamp_));
+            closed = true;
+        }
+        emit(traffic(out));
+        ++traffic_msgs;
+    }
+
+    emit(system_event(out, 'E', timestamp_)); // end of system hours
+    emit(system_event(out, 'C', timestamp_)); // end of messages
+    return msgs;
+}
+
+Itch_Generator::Msg Itch_Generator::msg(char type, std::uint16_t locate)
+{
+    return Msg{type, locate, ++tracking_, timestamp_};
+}
+
+std::size_t Itch_Generator::system_event(std::ostream& out, char event_code, std::uint64_t timestamp)
+{
+    return Msg{'S', 0, ++tracking_, timestamp}.u8(static_cast<std::uint8_t>(event_code)).emit(out);
+}
+
+std::size_t Itch_Generator::stock_directory(std::ostream& out, std::uint16_t locate)
+{
+    return msg('R', locate)
+        .alpha(symbols_[locate - 1], itch::stock_len)
+        .u8('Q')  // market category: nasdaq global select
+        .u8('N')  // financial status: normal
+        .u32(100) // round lot size
+        .u8('N')  // round lots only
+        .u8('C')  // issue classification: common stock
+        .alpha("Z", 2)
+        .u8('P')  // authenticity: live
+        .u8('N')  // short sale threshold
+        .u8('N')  // ipo flag
+        .u8('1')  // luld tier
+        .u8('N')  // etp flag
+        .u32(0)   // etp leverage
+        .u8('N')  // inverse
+        .emit(out);
+}
+
+std::size_t Itch_Generator::traffic(std::ostream& out)
+{
+    auto type{mix_types_[mix_dist_(rng_)]};
+    if (orders_.size() >= max_live_orders)
+    {
+        type = 'D';
+    }
+    else if (orders_.empty() && type != 'P')
+    {
+        type = 'A';
+    }
+
+    std::uniform_int_distribution<std::uint32_t> lots{1, 10};
+    switch (type)
+    {
+    case 'A':
+        return add_order(out, false);
+    case 'F':
+        return add_order(out, true);
+    case 'E':
+    case 'C': {
+        auto& order{random_order()};
+        const auto shares{std::min(order.shares, lots(rng_) * 100)};
+        auto exec{msg(type, order.locate).u64(order.ref).u32(shares).u64(next_match_++)};
+        if (type == 'C')
+        {
+            exec.u8('Y').u32(order.price);
+        }
+        const auto len{exec.emit(out)};
+        order.shares -= shares;
+        if (order.shares == 0)
+        {
+            remove_order(last_order_idx_);
+        }
+        return len;
+    }
+    case 'X': {
+        auto& order{random_order()};
+        const auto shares{std::min(order.shares, lots(rng_) * 100)};
+        const auto len{msg('X', order.locate).u64(order.ref).u32(shares).emit(out)};
+        order.shares -= shares;
+        if (order.shares == 0)
+        {
+            remove_order(last_order_idx_);
+        }
+        return len;
+    }
+    case 'D': {
+        const auto& order{random_order()};
+        const auto len{msg('D', order.locate).u64(order.ref).emit(out)};
+        remove_order(last_order_idx_);
+        return len;
+    }
+    case 'U': {
+        auto& order{random_order()};
+        const auto new_ref{next_order_ref_++};
+        order.shares = lots(rng_) * 100;
+        // step a penny away from the touch
+        order.price = order.side == 'B' ? std::max<std::uint32_t>(order.price - 100, 100) : order.price + 100;
+        const auto len{msg('U', order.locate).u64(order.ref).u64(new_ref).u32(order.shares).u32(order.price).emit(out)};
+        order.ref = new_ref;
+        return len;
+    }
+    default: { // 'P'
+        std::uniform_int_distribution<std::uint16_t> locate_dist{1, static_cast<std::uint16_t>(symbols_.size())};
+        const auto locate{locate_dist(rng_)};
+        return msg('P', locate)
+            .u64(0) // non displayed orders have no reference
+            .u8('B')
+            .u32(lots(rng_) * 100)
+            .alpha(symbols_[locate - 1U], itch::stock_len)
+            .u32(base_prices_[locate - 1U])
+            .u64(next_match_++)
+            .emit(out);
+    }
+    }
+}
+
+std::size_t Itch_Generator::add_order(std::ostream& out, bool with_mpid)
+{
+    std::uniform_int_distribution<std::uint16_t> locate_dist{1, static_cast<std::uint16_t>(symbols_.size())};
+    std::uniform_int_distribution<std::uint32_t> lots{1, 10};
+    std::uniform_int_distribution<std::uint32_t> ticks{1, 50};
+
+    Order order{.ref = next_order_ref_++, .locate = locate_dist(rng_), .shares = lots(rng_) * 100, .price = 0, .side = 'B'};
+    order.side = (rng_() & 1U) != 0 ? 'B' : 'S';
+    // bids below the base price and offers above it, a penny a tick
+    const auto offset{ticks(rng_) * 100};
+    order.price = order.side == 'B' ? base_prices_[order.locate - 1U] - offset : base_prices_[order.locate - 1U] + offset;
+
+    auto add{msg(with_mpid ? 'F' : 'A', order.locate)
+                 .u64(order.ref)
+                 .u8(static_cast<std::uint8_t>(order.side))
+                 .u32(order.shares)
+                 .alpha(symbols_[order.locate - 1U], itch::stock_len)
+                 .u32(order.price)};
+    if (with_mpid)
+    {
+        add.alpha(mpids[order.ref % mpids.size()], 4);
+    }
+    orders_.push_back(order);
+    return add.emit(out);
+}
+
+void Itch_Generator::advance_clock()
+{
+    std::exponential_distribution<double> gap_dist{rate_ * rate_multiplier()};
+    timestamp_ += static_cast<std::uint64_t>(std::llround(gap_dist(rng_) * 1e9));
+}
+
+double Itch_Generator::rate_multiplier() const
+{
+    switch (rate_profile_)
+    {
+    case Rate_Profile::flat:
+        return 1.0;
+    case Rate_Profile::intraday: {
+        if (timestamp_ < market_open || timestamp_ >= market_close)
+        {
+            return 0.1;
+        }
+        // 0.4 + 2.4(2x - 1)^2 averages 1.2 over the day
+        const auto x{static_cast<double>(timestamp_ - market_open) / static_cast<double>(market_close - market_open)};
+        return (0.4 + (2.4 * (2 * x - 1) * (2 * x - 1))) / 1.2;
+    }
+    case Rate_Profile::bursty: {
+        constexpr std::uint64_t period{100'000'000};
+        constexpr std::uint64_t burst{5'000'000};
+        // 0.95 * 1 + 0.05 * 20 averages 1.95
+        return (timestamp_ % period < burst ? 20.0 : 1.0) / 1.95;
+    }
+    }
+    return 1.0;
+}
+
+Itch_Generator::Order& Itch_Generator::random_order()
+{
+    std::uniform_int_distribution<std::size_t> idx_dist{0, orders_.size() - 1};
+    last_order_idx_ = idx_dist(rng_);
+    return orders_[last_order_idx_];
+}
+
+void Itch_Generator::remove_order(std::size_t idx)
+{
+    orders_[idx] = orders_.back();
+    orders_.pop_back();
+}
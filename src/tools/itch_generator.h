@@ -0,0 +1,111 @@
+#ifndef ITCH_GENERATOR_H
+#define ITCH_GENERATOR_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class Rate_Profile
+{
+    flat,     // constant rate all session
+    intraday, // U shaped, busiest at the open and close
+    bursty    // flat with 20x bursts for 5ms of every 100ms
+};
+
+// for CLI11
+const std::map<std::string, Rate_Profile> rate_profile_map{{"flat", Rate_Profile::flat},
+                                                           {"intraday", Rate_Profile::intraday},
+                                                           {"bursty", Rate_Profile::bursty}};
+
+// relative weight of each order book message type in the generated traffic
+using Msg_Mix = std::map<char, double>;
+
+// message types the generator can produce, add order is always allowed since the
+// others need a live order to refer to
+constexpr std::string_view generated_msg_types{"AFECXDUP"};
+
+// "A=40,D=35,..." to a Msg_Mix, nullopt if malformed or a type is not generated
+std::optional<Msg_Mix> parse_msg_mix(std::string_view str);
+
+// writes a valid length prefixed ITCH 5.0 session: system events, a stock directory of
+// num_symbols stocks, then order book traffic. Orders are tracked so executions, cancels,
+// deletes and replaces refer to live orders. Market hours open at 09:30 and close at 16:00
+// in timestamp order regardless of where the traffic starts and ends
+class Itch_Generator
+{
+  public:
+    Itch_Generator(std::size_t num_symbols,
+                   const Msg_Mix& msg_mix,
+                   double rate,
+                   Rate_Profile rate_profile,
+                   std::chrono::nanoseconds start_time,
+                   std::uint64_t seed);
+
+    // stops after max_msgs traffic messages or max_bytes of output, whichever is first (0 for no limit)
+    // returns the total messages written
+    std::uint64_t write(std::ostream& out, std::uint64_t max_msgs, std::uint64_t max_bytes);
+
+  private:
+    struct Order
+    {
+        std::uint64_t ref;
+        std::uint16_t locate;
+        std::uint32_t shares;
+        std::uint32_t price;
+        char side;
+    };
+
+    // message being built, fields are appended big endian after the common header
+    class Msg
+    {
+      public:
+        Msg(char type, std::uint16_t locate, std::uint16_t tracking, std::uint64_t timestamp);
+        Msg& u8(std::uint8_t val);
+        Msg& u16(std::uint16_t val);
+        Msg& u32(std::uint32_t val);
+        Msg& u64(std::uint64_t val);
+        Msg& alpha(std::string_view val, std::size_t len);
+        std::size_t emit(std::ostream& out);
+
+      private:
+        Msg& be(std::uint64_t val, std::size_t size);
+
+        std::array<char, 64> buf_{};
+        std::size_t len_;
+    };
+
+    Msg msg(char type, std::uint16_t locate);
+    std::size_t system_event(std::ostream& out, char event_code, std::uint64_t timestamp);
+    std::size_t stock_directory(std::ostream& out, std::uint16_t locate);
+    std::size_t traffic(std::ostream& out);
+    std::size_t add_order(std::ostream& out, bool with_mpid);
+    void advance_clock();
+    double rate_multiplier() const;
+    Order& random_order();
+    void remove_order(std::size_t idx);
+
+    std::vector<std::string> symbols_;
+    std::vector<std::uint32_t> base_prices_;
+    std::vector<char> mix_types_;
+    std::discrete_distribution<std::size_t> mix_dist_;
+    double rate_;
+    Rate_Profile rate_profile_;
+    std::mt19937_64 rng_;
+
+    std::uint64_t timestamp_;
+    std::uint16_t tracking_{0};
+    std::uint64_t next_order_ref_{1};
+    std::uint64_t next_match_{1};
+    std::vector<Order> orders_;
+    std::size_t last_order_idx_{0};
+};
+
+#endif
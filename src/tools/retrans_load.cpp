@@ -0,0 +1,446 @@
+// joins the downstream group as N simulated clients, each dropping packets by its own
+// loss pattern and recovering the gaps from the retransmission server
+#include "latency_histogram.h"
+#include "mold_udp_64.h"
+
+#include "jamutils/M_Map.h"
+
+#include <CLI/App.hpp>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <print>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace
+{
+enum class Loss_Pattern
+{
+    random, // each packet lost independently
+    burst   // runs of burst_len consecutive packets lost
+};
+
+const std::map<std::string, Loss_Pattern> loss_pattern_map{{"random", Loss_Pattern::random},
+                                                           {"burst", Loss_Pattern::burst}};
+
+std::atomic<bool> stop_requested{false};
+
+// jam_utils::FD from a call which returns -1 on error
+jam_utils::FD checked_fd(int fd, const char* what)
+{
+    if (fd < 0)
+    {
+        throw std::system_error(errno, std::system_category(), what);
+    }
+    return jam_utils::FD{fd};
+}
+
+sockaddr_in make_addr(const std::string& address, std::uint16_t port)
+{
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1)
+    {
+        throw std::invalid_argument(std::format("invalid ip format {}", address));
+    }
+    return addr;
+}
+
+struct Gap
+{
+    std::uint64_t seq;
+    std::uint64_t count;
+};
+
+struct Stats
+{
+    std::uint64_t packets{};
+    std::uint64_t packets_lost{};
+    std::uint64_t gaps{};
+    std::uint64_t gaps_filled{};
+    std::uint64_t gaps_missed{};
+    std::uint64_t requests{};
+    std::uint64_t responses{};
+    std::uint64_t msgs_recovered{};
+    Latency_Histogram latency;
+};
+
+class Client
+{
+  public:
+    Client(const sockaddr_in& retrans_addr,
+           Loss_Pattern loss_pattern,
+           double loss_rate,
+           std::size_t burst_len,
+           std::uint64_t seed)
+        : sock_{checked_fd(socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0), "socket")},
+          loss_pattern_{loss_pattern},
+          loss_rate_{loss_rate},
+          burst_len_{burst_len},
+          rng_{seed}
+    {
+        if (connect(sock_.fd(), reinterpret_cast<const sockaddr*>(&retrans_addr), sizeof(retrans_addr)) < 0)
+        {
+            throw std::system_error(errno, std::system_category(), "connect");
+        }
+    }
+
+    int fd() const { return sock_.fd(); }
+
+    // a downstream packet every client sees, the loss pattern decides whether this one did
+    void on_downstream(std::uint64_t seq, std::uint16_t msg_count, const mold_udp_64::Downstream_Header& session, Stats& stats)
+    {
+        ++stats.packets;
+        if (lose_packet())
+        {
+            ++stats.packets_lost;
+            if (!gaps_.empty() && gaps_.back().seq + gaps_.back().count == seq && &gaps_.back() != outstanding())
+            {
+                gaps_.back().count += msg_count;
+            }
+            else
+            {
+                gaps_.push_back({seq, msg_count});
+                ++stats.gaps;
+            }
+        }
+        send_next(session, stats);
+    }
+
+    void on_response(const mold_udp_64::Downstream_Header& session, Stats& stats)
+    {
+        mold_udp_64::Downstream_Header header;
+        while (true)
+        {
+            std::array<std::byte, mold_udp_64::max_payload_size> buf{};
+            const auto len{recv(sock_.fd(), buf.data(), buf.size(), 0)};
+            if (len < 0)
+            {
+                if (errno != EAGAIN)
+                {
+                    std::perror("recv");
+                }
+                break;
+            }
+            if (static_cast<std::size_t>(len) < sizeof(header) || !request_sent_)
+            {
+                continue;
+            }
+            std::memcpy(&header, buf.data(), sizeof(header));
+            const auto seq{be64toh(header.sequence_num)};
+            const auto count{ntohs(header.msg_count)};
+            auto& gap{gaps_.front()};
+            if (seq != gap.seq || count == 0)
+            {
+                continue; // late response to a request that already timed out
+            }
+
+            ++stats.responses;
+            stats.msgs_recovered += count;
+            stats.latency.record(std::chrono::steady_clock::now() - request_sent_at_);
+            request_sent_ = false;
+
+            // a response carries at most one packet of messages, ask again for the rest
+            gap.seq += count;
+            gap.count -= std::min<std::uint64_t>(count, gap.count);
+            if (gap.count == 0)
+            {
+                ++stats.gaps_filled;
+                gaps_.pop_front();
+            }
+        }
+        send_next(session, stats);
+    }
+
+    void check_timeout(std::chrono::steady_clock::time_point now,
+                       std::chrono::milliseconds timeout,
+                       const mold_udp_64::Downstream_Header& session,
+                       Stats& stats)
+    {
+        if (request_sent_ && now - request_sent_at_ > timeout)
+        {
+            ++stats.gaps_missed;
+            gaps_.pop_front();
+            request_sent_ = false;
+            send_next(session, stats);
+        }
+    }
+
+  private:
+    bool lose_packet()
+    {
+        if (burst_remaining_ > 0)
+        {
+            --burst_remaining_;
+            return true;
+        }
+        std::uniform_real_distribution<double> dist{0, 1};
+        if (loss_pattern_ == Loss_Pattern::random)
+        {
+            return dist(rng_) < loss_rate_;
+        }
+        // bursts start often enough for the same overall loss rate
+        if (dist(rng_) < loss_rate_ / static_cast<double>(burst_len_))
+        {
+            burst_remaining_ = burst_len_ - 1;
+            return true;
+        }
+        return false;
+    }
+
+    const Gap* outstanding() const { return request_sent_ ? &gaps_.front() : nullptr; }
+
+    // one request in flight per client, like a real feed handler recovering in order
+    void send_next(const mold_udp_64::Downstream_Header& session, Stats& stats)
+    {
+        if (request_sent_ || gaps_.empty())
+        {
+            return;
+        }
+        auto request{session};
+        request.sequence_num = htobe64(gaps_.front().seq);
+        request.msg_count = htons(static_cast<std::uint16_t>(std::min<std::uint64_t>(gaps_.front().count, UINT16_MAX - 1)));
+        if (send(sock_.fd(), &request, sizeof(request), 0) < 0)
+        {
+            std::perror("send");
+            return;
+        }
+        ++stats.requests;
+        request_sent_ = true;
+        request_sent_at_ = std::chrono::steady_clock::now();
+    }
+
+    jam_utils::FD sock_;
+    Loss_Pattern loss_pattern_;
+    double loss_rate_;
+    std::size_t burst_len_;
+    std::size_t burst_remaining_{0};
+    std::mt19937_64 rng_;
+
+    std::deque<Gap> gaps_;
+    bool request_sent_{false};
+    std::chrono::steady_clock::time_point request_sent_at_;
+};
+} // namespace
+
+int main(const int argc, char** argv)
+{
+    CLI::App cli{"Retransmission load generator"};
+
+    std::string session;
+    cli.add_option("session",
+                   session,
+                   "MoldUDP64 Session")
+        ->required()
+        ->check([](const std::string& str) {
+            if (str.length() != mold_udp_64::session_len)
+            {
+                return "session must be exactly 10 characters";
+            }
+            return "";
+        });
+
+    std::string downstream_group{"239.0.0.1"};
+    int downstream_port{30000};
+    std::string interface{"0.0.0.0"};
+    std::string retrans_address{"127.0.0.1"};
+    int retrans_port{31000};
+
+    cli.add_option("--downstream-group", downstream_group, "Downstream group")->capture_default_str();
+    cli.add_option("--downstream-port", downstream_port, "Downstream port")
+        ->check(CLI::Range(1025, 65535))
+        ->capture_default_str();
+    cli.add_option("--interface", interface, "Address of the interface to join the group on")->capture_default_str();
+    cli.add_option("--retrans-address", retrans_address, "Retransmission server address")->capture_default_str();
+    cli.add_option("--retrans-port", retrans_port, "Retransmission server port")
+        ->check(CLI::Range(1025, 65535))
+        ->capture_default_str();
+
+    std::size_t num_clients{16};
+    auto loss_pattern{Loss_Pattern::random};
+    double loss_rate{0.01};
+    std::size_t burst_len{8};
+    std::int64_t timeout_ms{100};
+    std::int64_t duration_s{0};
+    std::uint64_t seed{1};
+
+    cli.add_option("--clients", num_clients, "Simulated clients, each with its own socket and losses")
+        ->check(CLI::Range(std::size_t{1}, std::size_t{4096}))
+        ->capture_default_str();
+    cli.add_option("--loss", loss_pattern, "Loss pattern (random, burst)")
+        ->transform(CLI::CheckedTransformer(loss_pattern_map, CLI::ignore_case))
+        ->capture_default_str();
+    cli.add_option("--loss-rate", loss_rate, "Fraction of downstream packets each client loses")
+        ->check(CLI::Range(0.0, 1.0))
+        ->capture_default_str();
+    cli.add_option("--burst-len", burst_len, "Consecutive packets lost per burst with --loss burst")
+        ->check(CLI::Range(std::size_t{1}, std::size_t{1024}))
+        ->capture_default_str();
+    cli.add_option("--timeout", timeout_ms, "Milliseconds to wait for a response before counting the gap missed")
+        ->check(CLI::PositiveNumber)
+        ->capture_default_str();
+    cli.add_option("--duration", duration_s, "Seconds to run, 0 to run until the end of session")
+        ->check(CLI::NonNegativeNumber)
+        ->capture_default_str();
+    cli.add_option("--seed", seed, "Random seed for the loss patterns")->capture_default_str();
+
+    CLI11_PARSE(cli, argc, argv);
+
+    std::signal(SIGINT, [](int) { stop_requested = true; });
+
+    try
+    {
+        const mold_udp_64::Downstream_Header session_header{session};
+        const auto retrans_addr{make_addr(retrans_address, static_cast<std::uint16_t>(retrans_port))};
+
+        const auto downstream{checked_fd(socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0), "socket")};
+        constexpr int opt{1};
+        auto group_addr{make_addr(downstream_group, static_cast<std::uint16_t>(downstream_port))};
+        ip_mreq mreq{.imr_multiaddr = group_addr.sin_addr, .imr_interface = make_addr(interface, 0).sin_addr};
+        constexpr int rcvbuf{1 << 24};
+        if (setsockopt(downstream.fd(), SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+            setsockopt(downstream.fd(), SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0 ||
+            bind(downstream.fd(), reinterpret_cast<const sockaddr*>(&group_addr), sizeof(group_addr)) < 0 ||
+            setsockopt(downstream.fd(), IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+        {
+            throw std::system_error(errno, std::system_category(), "joining downstream group");
+        }
+
+        const auto epoll{checked_fd(epoll_create1(0), "epoll_create1")};
+        epoll_event ev{.events = EPOLLIN, .data = {.u64 = num_clients}};
+        if (epoll_ctl(epoll.fd(), EPOLL_CTL_ADD, downstream.fd(), &ev) < 0)
+        {
+            throw std::system_error(errno, std::system_category(), "epoll_ctl");
+        }
+
+        std::vector<std::unique_ptr<Client>> clients;
+        for (std::size_t i = 0; i < num_clients; ++i)
+        {
+            clients.push_back(std::make_unique<Client>(retrans_addr, loss_pattern, loss_rate, burst_len, seed + i));
+            ev.data.u64 = i;
+            if (epoll_ctl(epoll.fd(), EPOLL_CTL_ADD, clients.back()->fd(), &ev) < 0)
+            {
+                throw std::system_error(errno, std::system_category(), "epoll_ctl");
+            }
+        }
+
+        std::println("Listening on {}:{} with {} clients", downstream_group, downstream_port, num_clients);
+
+        Stats stats;
+        std::array<epoll_event, 256> events{};
+        std::optional<std::chrono::steady_clock::time_point> first_packet_at;
+        bool end_of_session{false};
+        const std::chrono::milliseconds timeout{timeout_ms};
+
+        while (!stop_requested && !end_of_session)
+        {
+            const auto now{std::chrono::steady_clock::now()};
+            if (duration_s > 0 && first_packet_at && now - *first_packet_at > std::chrono::seconds{duration_s})
+            {
+                break;
+            }
+
+            const int nfds{epoll_wait(epoll.fd(), events.data(), static_cast<int>(events.size()), 1)};
+            if (nfds < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::system_error(errno, std::system_category(), "epoll_wait");
+            }
+
+            for (std::size_t i = 0; i < static_cast<std::size_t>(nfds); ++i)
+            {
+                const auto idx{events[i].data.u64};
+                if (idx < num_clients)
+                {
+                    clients[idx]->on_response(session_header, stats);
+                    continue;
+                }
+
+                std::array<std::byte, mold_udp_64::max_payload_size> buf{};
+                ssize_t len{};
+                while ((len = recv(downstream.fd(), buf.data(), buf.size(), 0)) >= 0)
+                {
+                    mold_udp_64::Downstream_Header header;
+                    if (static_cast<std::size_t>(len) < sizeof(header))
+                    {
+                        continue;
+                    }
+                    std::memcpy(&header, buf.data(), sizeof(header));
+                    if (header.session != session_header.session)
+                    {
+                        continue;
+                    }
+                    const auto msg_count{ntohs(header.msg_count)};
+                    if (msg_count == mold_udp_64::end_of_session_flag)
+                    {
+                        end_of_session = true;
+                        break;
+                    }
+                    if (!first_packet_at)
+                    {
+                        first_packet_at = std::chrono::steady_clock::now();
+                    }
+                    for (auto& client : clients)
+                    {
+                        client->on_downstream(be64toh(header.sequence_num), msg_count, session_header, stats);
+                    }
+                }
+            }
+
+            const auto after{std::chrono::steady_clock::now()};
+            for (auto& client : clients)
+            {
+                client->check_timeout(after, timeout, session_header, stats);
+            }
+        }
+
+        const std::chrono::duration<double> elapsed{first_packet_at ? std::chrono::steady_clock::now() - *first_packet_at
+                                                                    : std::chrono::steady_clock::duration{}};
+        std::println("Downstream packets seen {} (per client), lost {} across clients",
+                     stats.packets / num_clients,
+                     stats.packets_lost);
+        std::println("Requests {} ({:.0f}/s) responses {} msgs recovered {}",
+                     stats.requests,
+                     elapsed.count() > 0 ? static_cast<double>(stats.requests) / elapsed.count() : 0.0,
+                     stats.responses,
+                     stats.msgs_recovered);
+        std::println("Gaps {} filled {} missed {} outstanding {}",
+                     stats.gaps,
+                     stats.gaps_filled,
+                     stats.gaps_missed,
+                     stats.gaps - stats.gaps_filled - stats.gaps_missed);
+        std::println("Response latency p50 {} p99 {} p99.9 {} max {}",
+                     stats.latency.percentile(50),
+                     stats.latency.percentile(99),
+                     stats.latency.percentile(99.9),
+                     stats.latency.max());
+        return 0;
+    }
+    catch (const std::exception& ex)
+    {
+        std::println(std::cerr, "{}", ex.what());
+        return -1;
+    }
+}